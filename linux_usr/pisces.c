@@ -67,6 +67,18 @@ pisces_launch(int pisces_id,
 	      int block_id, 
 	      int numa_zone, 
 	      int num_blocks)
+{
+    return pisces_launch_cons(pisces_id, cpu_id, block_id, numa_zone, num_blocks, 0);
+}
+
+
+int
+pisces_launch_cons(int                pisces_id, 
+		   int                cpu_id, 
+		   int                block_id, 
+		   int                numa_zone, 
+		   int                num_blocks,
+		   unsigned long long console_ring_size)
 {
     char * enclave_path = get_pisces_dev_path(pisces_id);
     int    ret          = 0;
@@ -75,6 +87,8 @@ pisces_launch(int pisces_id,
 
     memset(&boot_env, 0, sizeof(struct enclave_boot_env));
 
+    boot_env.console_ring_size = console_ring_size;
+
 
 
     if (enclave_path == NULL) {
@@ -200,3 +214,56 @@ pisces_reset(int pisces_id)
 
     return 0;
 }
+
+
+int
+pisces_launch_res(int                       pisces_id, 
+		  int                       num_cpus, 
+		  int                     * cpus, 
+		  int                       num_ranges, 
+		  struct pisces_mem_range * ranges)
+{
+    char         * enclave_path = get_pisces_dev_path(pisces_id);
+    unsigned int * cpu_ids      = NULL;
+    int            ret          = 0;
+    int            i            = 0;
+
+    struct enclave_launch_res launch_res;
+
+    memset(&launch_res, 0, sizeof(struct enclave_launch_res));
+
+    if (enclave_path == NULL) {
+	return -1;
+    }
+
+    cpu_ids = malloc(sizeof(unsigned int) * num_cpus);
+
+    if (cpu_ids == NULL) {
+	printf("Error: Could not allocate CPU list\n");
+	free(enclave_path);
+	return -1;
+    }
+
+    for (i = 0; i < num_cpus; i++) {
+	cpu_ids[i] = cpus[i];
+    }
+
+    launch_res.num_cpus       = num_cpus;
+    launch_res.num_mem_ranges = num_ranges;
+    launch_res.cpus           = (uintptr_t)cpu_ids;
+    launch_res.mem_ranges     = (uintptr_t)ranges;
+
+    printf("Launching Enclave (%s) on CPU %d with %d CPUs and %d memory ranges\n", 
+	   enclave_path, cpus[0], num_cpus, num_ranges);
+
+    ret = pet_ioctl_path(enclave_path, PISCES_ENCLAVE_LAUNCH_RES, &launch_res);
+
+    if (ret < 0) {
+	printf("Error launching enclave. Code=%d\n", ret);
+    }
+
+    free(cpu_ids);
+    free(enclave_path);
+
+    return (ret < 0) ? -1 : 0;
+}
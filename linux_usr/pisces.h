@@ -21,6 +21,28 @@ int pisces_launch(int pisces_id,
 		  int numa_zone, 
 		  int num_blocks);
 
+/* Same as pisces_launch(), with a console ring of console_ring_size bytes 
+ *  (a power of two between 64KB and 16MB, 0 for the default) 
+ */
+int pisces_launch_cons(int                pisces_id, 
+		       int                cpu_id, 
+		       int                block_id, 
+		       int                numa_zone, 
+		       int                num_blocks,
+		       unsigned long long console_ring_size);
+
+
+struct pisces_mem_range;
+
+/* Launches an enclave with all of its (already offlined) CPUs and memory 
+ *  cpus[0] is the boot CPU, ranges[0] is boot memory
+ */
+int pisces_launch_res(int                       pisces_id, 
+		      int                       num_cpus, 
+		      int                     * cpus, 
+		      int                       num_ranges, 
+		      struct pisces_mem_range * ranges);
+
 
 int pisces_get_cons_fd(int pisces_id);
 
@@ -6,19 +6,168 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "pisces.h"
-#define INBUF_SIZE 4096
+#include "pisces_ioctl.h"
+
+#define INBUF_SIZE (64 * 1024)
+
+
+static void
+print_record(struct pisces_cons_record * rec)
+{
+    printf("[%llu] <%u> cpu %u: %.*s",
+           rec->tsc, rec->level, rec->cpu, (int)rec->len, rec->msg);
+
+    if ((rec->len == 0) || (rec->msg[rec->len - 1] != '\n')) {
+        printf("\n");
+    }
+}
+
+
+static unsigned int
+get_ring_flags(int cons_fd)
+{
+    struct pisces_cons_ring_hdr * hdr   = NULL;
+    unsigned int                  flags = 0;
+
+    hdr = mmap(NULL, PISCES_CONS_TAIL_OFFSET, PROT_READ, MAP_SHARED, cons_fd, 0);
+
+    if (hdr == MAP_FAILED) {
+        return 0;
+    }
+
+    flags = hdr->flags;
+    munmap(hdr, PISCES_CONS_TAIL_OFFSET);
+
+    return flags;
+}
+
+
+/* Consume the ring in place instead of copying it through read() */
+static int
+cons_mmap_loop(int cons_fd)
+{
+    struct pisces_cons_ring_hdr * hdr  = NULL;
+    volatile unsigned long long * head = NULL;
+    volatile unsigned long long * tail = NULL;
+    unsigned char               * data = NULL;
+    size_t                        ring_size = 0;
+    void                        * ring      = NULL;
+    int                           hup       = 0;
+
+    /* Map the header first to learn the ring size */
+    hdr = mmap(NULL, PISCES_CONS_TAIL_OFFSET, PROT_READ, MAP_SHARED, cons_fd, 0);
+
+    if (hdr == MAP_FAILED) {
+        printf("Error mapping console ring\n");
+        return -1;
+    }
+
+    ring_size = PISCES_CONS_DATA_OFFSET + hdr->size;
+    munmap(hdr, PISCES_CONS_TAIL_OFFSET);
+
+    ring = mmap(NULL, ring_size, PROT_READ, MAP_SHARED, cons_fd, 0);
+    tail = mmap(NULL, getpagesize(), PROT_READ | PROT_WRITE, MAP_SHARED, cons_fd, PISCES_CONS_TAIL_OFFSET);
+
+    if ((ring == MAP_FAILED) || (tail == MAP_FAILED)) {
+        printf("Error mapping console ring\n");
+        return -1;
+    }
+
+    hdr  = ring;
+    head = (unsigned long long *)((char *)ring + PISCES_CONS_HEAD_OFFSET);
+    data = (unsigned char *)ring + PISCES_CONS_DATA_OFFSET;
+
+    while (1) {
+        struct pollfd      pfd = {cons_fd, POLLIN, 0};
+        unsigned long long cur_head = *head;
+        unsigned long long cur_tail = *tail;
+
+        __sync_synchronize();
+
+        while (cur_tail != cur_head) {
+            unsigned long long idx    = cur_tail & hdr->mask;
+            unsigned long long contig = hdr->size - idx;
+
+            if (hdr->flags & PISCES_CONS_FLAG_RECORDS) {
+                struct pisces_cons_record * rec = (struct pisces_cons_record *)(data + idx);
+                unsigned long long rec_bytes = sizeof(struct pisces_cons_record) + rec->len;
+
+                if ((rec->flags & PISCES_CONS_REC_PAD) && (contig <= cur_head - cur_tail)) {
+                    cur_tail += contig;
+                    continue;
+                }
+
+                if ((rec->flags & PISCES_CONS_REC_PAD) || (rec_bytes > contig)) {
+                    printf("Corrupt console record\n");
+                    cur_tail = cur_head;
+                    break;
+                }
+
+                print_record(rec);
+                cur_tail += (rec_bytes + PISCES_CONS_REC_ALIGN - 1) & ~(PISCES_CONS_REC_ALIGN - 1ULL);
+            } else {
+                unsigned long long len = cur_head - cur_tail;
+
+                if (len > contig) {
+                    len = contig;
+                }
+
+                fwrite(data + idx, 1, len, stdout);
+                cur_tail += len;
+            }
+        }
+
+        fflush(stdout);
+
+        __sync_synchronize();
+        *tail = cur_tail;
+
+        if (hup) {
+            /* Drained what was written before the hangup */
+            break;
+        }
+
+        if ((poll(&pfd, 1, -1) == -1) && (errno != EINTR)) {
+            printf("Console error\n");
+            return -1;
+        }
+
+        /* The enclave is being freed, it can't be until we unmap */
+        if (pfd.revents & POLLHUP) {
+            hup = 1;
+        }
+    }
+
+    munmap((void *)tail, getpagesize());
+    munmap(ring, ring_size);
+
+    return 0;
+}
+
 
 int main(int argc, char* argv[]) {
     int  cons_fd;
-    char inbuf[INBUF_SIZE + 1];
+    int  use_mmap = 0;
+    int  records  = 0;
+    char * inbuf  = NULL;
+
+    if ((argc > 2) && (strcmp(argv[1], "-m") == 0)) {
+      use_mmap = 1;
+      argv++;
+      argc--;
+    }
 
     if (argc < 2) {
-      printf("usage: pisces_cons <enclave_device>\n");
+      printf("usage: pisces_cons [-m] <enclave_device>\n");
       return -1;
     }
 
@@ -29,10 +178,37 @@ int main(int argc, char* argv[]) {
       return -1;
     }
 
+    if (use_mmap) {
+      int ret = cons_mmap_loop(cons_fd);
+
+      close(cons_fd);
+      return ret;
+    }
+
+    records = (get_ring_flags(cons_fd) & PISCES_CONS_FLAG_RECORDS);
+    inbuf   = malloc(INBUF_SIZE + 1);
+
+    if (inbuf == NULL) {
+      printf("Error allocating console buffer\n");
+      close(cons_fd);
+      return -1;
+    }
+
     while (1) {
         int bytes_read = 0;
 
+        /* Blocks until the enclave writes, returns 0 once the enclave is freed */
         bytes_read = read(cons_fd, inbuf, INBUF_SIZE);
+        if ((bytes_read == -1) && (errno == EINTR)) {
+          continue;
+        }
+
+        if ((bytes_read == -1) && (errno == EOVERFLOW)) {
+          /* We fell too far behind the other readers */
+          printf("\n[console output lost]\n");
+          continue;
+        }
+
         if (bytes_read == -1) {
           printf("Console error\n");
           return -1;
@@ -42,13 +218,26 @@ int main(int argc, char* argv[]) {
           break;
         }
 
-        inbuf[bytes_read] = '\0';
-        printf("%s", inbuf);
+        if (records) {
+          int off = 0;
+
+          /* read() only returns whole records */
+          while (off < bytes_read) {
+            struct pisces_cons_record * rec = (struct pisces_cons_record *)(inbuf + off);
+
+            print_record(rec);
+            off += sizeof(struct pisces_cons_record) + rec->len;
+          }
+        } else {
+          inbuf[bytes_read] = '\0';
+          printf("%s", inbuf);
+        }
+
+        fflush(stdout);
     }
 
+    free(inbuf);
     close(cons_fd);
 
     return 0;
 }
-
-
@@ -307,5 +307,29 @@ pisces_load_file(int    pisces_id,
     strncpy(file_pair.lwk_file, remote_file, 127);
     
 
+    /* Try a host driven bulk transfer first, older enclaves only support LOAD_FILE */
+    {
+	struct pisces_stage_file stage_spec;
+
+	memset(&stage_spec, 0, sizeof(struct pisces_stage_file));
+
+	memcpy(&(stage_spec.file_pair), &file_pair, sizeof(struct pisces_file_pair));
+	stage_spec.direction = PISCES_STAGE_LOAD;
+
+	if (pisces_send_ctrl_cmd(pisces_id, PISCES_CMD_STAGE_FILE, &stage_spec) == 0) {
+	    double mbytes = (double)stage_spec.bytes / (1024 * 1024);
+	    double secs   = (double)stage_spec.usecs / 1000000;
+
+	    printf("Staged %llu bytes in %llu usecs (%.2f MB/s)\n", 
+		   (unsigned long long)stage_spec.bytes, 
+		   (unsigned long long)stage_spec.usecs, 
+		   (secs > 0) ? (mbytes / secs) : 0.0);
+
+	    return 0;
+	}
+
+	printf("Bulk staging failed, falling back to enclave driven load\n");
+    }
+
     return pisces_send_ctrl_cmd(pisces_id, PISCES_CMD_LOAD_FILE, &file_pair);
 }
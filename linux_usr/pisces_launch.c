@@ -15,7 +15,8 @@ static void usage() {
 	   " [-b, --block=block_id] "			\
 	   " [-m, --num-blocks=N] "			\
 	   " [-c, --cpu=cpu_id] "			\
-	   " [-n, --numa=numa_zone]\n");
+	   " [-n, --numa=numa_zone] "			\
+	   " [-s, --console-size=KB]\n");
     exit(-1);
 }
 
@@ -28,6 +29,7 @@ main(int argc, char ** argv)
     int    block_id     = PISCES_ANY_MEMBLOCK;
     int    num_blocks   =  1;
     int    enclave_id   = -1;
+    unsigned long long cons_size = 0;
 
 
     /* Parse options */
@@ -40,10 +42,11 @@ main(int argc, char ** argv)
 	    {"num-blocks", required_argument, 0, 'm'},
 	    {"numa",       required_argument, 0, 'n'},
 	    {"cpu",        required_argument, 0, 'c'},
+	    {"console-size", required_argument, 0, 's'},
 	    {0, 0, 0, 0}
 	};
 
-	while ((c = getopt_long(argc, argv, "b:m:n:c:", long_options, &opt_index)) != -1) {
+	while ((c = getopt_long(argc, argv, "b:m:n:c:s:", long_options, &opt_index)) != -1) {
 	    switch (c) {
 		case 'n':
 		    numa_zone = atoi(optarg);
@@ -57,6 +60,9 @@ main(int argc, char ** argv)
 		case 'm':
 		    num_blocks = atoi(optarg);
 		    break;
+		case 's':
+		    cons_size = strtoull(optarg, NULL, 0) * 1024;
+		    break;
 		case '?':
 		    usage();
 		    break;
@@ -81,7 +87,7 @@ main(int argc, char ** argv)
 	}
     }
     
-    if (pisces_launch(enclave_id, cpu_id, block_id, numa_zone, num_blocks) != 0) {
+    if (pisces_launch_cons(enclave_id, cpu_id, block_id, numa_zone, num_blocks, cons_size) != 0) {
 	printf("Error: Could not launch enclave %d\n", enclave_id);
 	return -1;
     }
@@ -19,6 +19,8 @@
 #include <linux/kd.h>
 #include <linux/keyboard.h>
 #include <stdint.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
 
 #include <pet_ioctl.h>
 
@@ -227,42 +229,141 @@ int handle_update( void ) {
 }
 
 
-int handle_console_msg(int cons_fd) {
-    int ret = 0;
-    struct cons_msg msg;
-
-    ret = read(cons_fd, &msg, sizeof(struct cons_msg));
-
-    if (ret != sizeof(struct cons_msg)) {
-	printf("ERROR: Could not read console message\n");
-	return ret;
-    }
-
-    switch (msg.op) {
+static void dispatch_console_msg(struct cons_msg * msg) {
+    switch (msg->op) {
 	case CONSOLE_CURS_SET:
-	    //	    printf("Console cursor set (x=%d, y=%d)\n", msg.cursor.x, msg.cursor.y);
-	    handle_curs_set(&(msg.cursor));
+	    //	    printf("Console cursor set (x=%d, y=%d)\n", msg->cursor.x, msg->cursor.y);
+	    handle_curs_set(&(msg->cursor));
 	    break;
 	case CONSOLE_CHAR_SET:
-	    handle_char_set(&(msg.character));
+	    handle_char_set(&(msg->character));
 	    /*	    printf("Console character set (x=%d, y=%d, c=%c, style=%c)\n", 
-	      msg.character.x, msg.character.y, msg.character.c, msg.character.style);*/
+		    msg->character.x, msg->character.y, msg->character.c, msg->character.style);*/
 	    break;
 	case CONSOLE_SCROLL:
-	    //  printf("Console scroll (lines=%d)\n", msg.scroll.lines);
-	    handle_scroll(&(msg.scroll));
+	    //  printf("Console scroll (lines=%d)\n", msg->scroll.lines);
+	    handle_scroll(&(msg->scroll));
 	    break;
 	case CONSOLE_UPDATE:
 	    // printf("Console update\n");
 	    handle_update();
 	    break;
 	case CONSOLE_RESOLUTION:
-	    handle_text_resolution(&(msg.resolution));
+	    handle_text_resolution(&(msg->resolution));
 	    break;
 	default:
-	    printf("Invalid console message operation (%d)\n", msg.op);
+	    printf("Invalid console message operation (%d)\n", msg->op);
 	    break;
     }
+}
+
+
+#define CONS_MSG_BATCH 256
+
+int handle_console_msg(int cons_fd) {
+    static struct cons_msg msgs[CONS_MSG_BATCH];
+    int ret = 0;
+    int i   = 0;
+
+    /* The kernel returns as many whole messages as fit */
+    ret = read(cons_fd, msgs, sizeof(msgs));
+
+    if ((ret <= 0) || (ret % sizeof(struct cons_msg))) {
+	printf("ERROR: Could not read console message\n");
+	return -1;
+    }
+
+    for (i = 0; i < ret / sizeof(struct cons_msg); i++) {
+	dispatch_console_msg(&(msgs[i]));
+    }
+
+    return 0;
+}
+
+
+/* The console ring, when mapped into our address space */
+static struct {
+    void                       * map;
+    size_t                       map_size;
+    const volatile uint16_t    * read_idx;
+    const volatile uint16_t    * cur_entries;
+    struct cons_msg            * msgs;
+    uint16_t                     total_entries;
+    int                          event_fd;
+    int                          cons_fd;
+} ring;
+
+static int map_console_ring(int cons_fd) {
+    struct vm_cons_ring_info info;
+    char * base = NULL;
+
+    memset(&info, 0, sizeof(struct vm_cons_ring_info));
+
+    if ((pet_ioctl_fd(cons_fd, PISCES_VM_CONS_RING_INFO, &info) != 0) ||
+	(info.msg_size != sizeof(struct cons_msg))) {
+	return -1;
+    }
+
+    ring.map = mmap(NULL, info.mmap_size, PROT_READ, MAP_SHARED, cons_fd, 0);
+
+    if (ring.map == MAP_FAILED) {
+	return -1;
+    }
+
+    ring.event_fd = eventfd(0, 0);
+
+    if ((ring.event_fd == -1) ||
+	(pet_ioctl_fd(cons_fd, PISCES_VM_CONS_SET_EVENTFD, (void *)(uint64_t)ring.event_fd) != 0)) {
+	if (ring.event_fd != -1) {
+	    close(ring.event_fd);
+	}
+
+	munmap(ring.map, info.mmap_size);
+	return -1;
+    }
+
+    base = (char *)ring.map + info.ring_offset;
+
+    ring.map_size      = info.mmap_size;
+    ring.read_idx      = (const volatile uint16_t *)(base + info.read_idx_offset);
+    ring.cur_entries   = (const volatile uint16_t *)(base + info.cur_entries_offset);
+    ring.msgs          = (struct cons_msg *)(base + info.msgs_offset);
+    ring.total_entries = info.total_entries;
+    ring.cons_fd       = cons_fd;
+
+    /* Drain anything queued before the eventfd was attached */
+    eventfd_write(ring.event_fd, 1);
+
+    return 0;
+}
+
+/* Consumes the mapped ring in place, see struct vm_cons_ring_info */
+int handle_console_ring(void) {
+    uint64_t kicks = 0;
+    uint16_t cnt   = 0;
+
+    if (read(ring.event_fd, &kicks, sizeof(kicks)) != sizeof(kicks)) {
+	printf("ERROR: Could not read console event\n");
+	return -1;
+    }
+
+    while ((cnt = *ring.cur_entries) > 0) {
+	uint16_t idx = *ring.read_idx;
+	uint16_t i   = 0;
+
+	__sync_synchronize();
+
+	for (i = 0; i < cnt; i++) {
+	    dispatch_console_msg(&(ring.msgs[idx]));
+	    idx = (idx + 1) % ring.total_entries;
+	}
+
+	/* The kernel hands the slots back under the ring lock */
+	if (pet_ioctl_fd(ring.cons_fd, PISCES_VM_CONS_CONSUME, (void *)(uint64_t)cnt) < 0) {
+	    printf("ERROR: Could not release console messages\n");
+	    return -1;
+	}
+    }
 
     return 0;
 }
@@ -335,7 +436,25 @@ static const struct key_code ascii_to_key_code[] = {             // ASCII Value
 
 
 
-#define writeit(fd,c)  do { if (debug_enable) { fprintf(stderr,"scancode 0x%x\n",(c));} if (write((fd),&(c),1)!=1) { return -1; } } while (0)
+/* Scan codes for a keystroke are queued and sent with a single write */
+static unsigned char key_buf[64];
+static int           key_cnt = 0;
+
+static int flush_keys(int fd) {
+    int ret = 0;
+
+    if (key_cnt > 0) {
+	ret = write(fd, key_buf, key_cnt);
+    }
+
+    ret     = (ret == key_cnt) ? 0 : -1;
+    key_cnt = 0;
+
+    return ret;
+}
+
+#define writeit(fd,c)  do { if (debug_enable) { fprintf(stderr,"scancode 0x%x\n",(c));} \
+	if ((key_cnt == sizeof(key_buf)) && (flush_keys(fd) != 0)) { return -1; } key_buf[key_cnt++] = (c); } while (0)
 
 int send_char_to_palacios_as_scancodes(int fd, unsigned char c)
 {
@@ -451,6 +570,11 @@ int main(int argc, char* argv[]) {
 	return -1;
     }
 
+    if (map_console_ring(cons_fd) != 0) {
+	/* Older modules only support read() */
+	ring.map = NULL;
+    }
+
     tcgetattr(STDIN_FILENO, &console.termios_old);
     atexit(handle_exit);
 
@@ -499,13 +623,20 @@ int main(int argc, char* argv[]) {
 
     while (1) {
 	int ret; 
+	int msg_fd = (ring.map) ? ring.event_fd : cons_fd;
+	int max_fd = (msg_fd > cons_fd) ? msg_fd : cons_fd;
 	fd_set rset;
 
 	FD_ZERO(&rset);
-	FD_SET(cons_fd, &rset);
+	FD_SET(msg_fd, &rset);
 	FD_SET(STDIN_FILENO, &rset);
 
-	ret = select(cons_fd + 1, &rset, NULL, NULL, NULL);
+	if (ring.map) {
+	    /* A mapped console only becomes readable when the enclave wants it unmapped */
+	    FD_SET(cons_fd, &rset);
+	}
+
+	ret = select(max_fd + 1, &rset, NULL, NULL, NULL);
 	
 	//	printf("Returned from select...\n");
 
@@ -516,13 +647,20 @@ int main(int argc, char* argv[]) {
 	    return -1;
 	}
 
-	if (FD_ISSET(cons_fd, &rset)) {
-	    if (handle_console_msg(cons_fd) == -1) {
+	if (FD_ISSET(msg_fd, &rset)) {
+	    ret = (ring.map) ? handle_console_ring() : handle_console_msg(cons_fd);
+
+	    if (ret == -1) {
 		printf("Console Error\n");
 		return -1;
 	    }
 	}
 
+	if ((ring.map) && (FD_ISSET(cons_fd, &rset))) {
+	    printf("Enclave is going away, closing the console\n");
+	    break;
+	}
+
 	if (FD_ISSET(STDIN_FILENO, &rset)) {
 	    int key = getch();
 
@@ -604,6 +742,11 @@ int main(int argc, char* argv[]) {
 		    return -1;
 		}
 	    }
+
+	    if (flush_keys(cons_fd) != 0) {
+		printf("Error sending key to console\n");
+		return -1;
+	    }
 	    
 	}
     } 
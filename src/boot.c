@@ -1,8 +1,15 @@
 #include <linux/delay.h>
 #include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/completion.h>
+#include <linux/interrupt.h>
+#include <linux/ktime.h>
 
 #include "enclave.h"
 #include "pisces_boot_params.h"
+#include "pisces_irq.h"
 #include "pgtables.h"
 #include "boot.h"
 
@@ -10,52 +17,151 @@
 #include "trampoline.h"
 
 
+/* 
+ * Delay between asserting and deasserting INIT, in usecs. 
+ *  -1 selects the same default as Linux: none on CPUs that don't need it, 10ms otherwise 
+ */
+static int init_udelay = -1;
+module_param(init_udelay, int, 0644);
+MODULE_PARM_DESC(init_udelay, "INIT assert delay in usecs (-1 = auto detect)");
+
+
+/* How long to wait for an enclave CPU to initialize */
+#define BOOT_TIMEOUT_MS   1500
+#define BOOT_POLL_US      100
+#define LAUNCH_POLL_US    10
+
+
 struct trampoline_data   trampoline_state;
+
+/* 
+ * Serializes use of the shared Linux trampoline. 
+ *  Only held while the trampoline points at an enclave, i.e. from the SIPI until 
+ *  the enclave CPU (and any CPUs in its launch resource list) has switched to its 
+ *  own page tables in the launch code
+ */
 static struct mutex      trampoline_lock;
 
-static struct page     * pgt_pages = NULL;
 
+#define KERN_VA_BASE  0xffffffff80000000ULL
 
-static void
-init_trampoline_pgts(void)
+
+/* Returns the physical address of a new zeroed page table page, or 0 */
+static uintptr_t
+alloc_pgt_page(struct enclave_pgts * pgts)
 {
-    /* 
-     * Clear the pages individually to avoid any overrun bugs
-     */
-    memset(__va(trampoline_state.pml_pa),  0, PAGE_SIZE);
-    memset(__va(trampoline_state.pdp0_pa), 0, PAGE_SIZE);
-    memset(__va(trampoline_state.pdp1_pa), 0, PAGE_SIZE);
-    memset(__va(trampoline_state.pdp2_pa), 0, PAGE_SIZE);
-    memset(__va(trampoline_state.pd0_pa),  0, PAGE_SIZE);
-    memset(__va(trampoline_state.pd1_pa),  0, PAGE_SIZE);
-    memset(__va(trampoline_state.pd2_pa),  0, PAGE_SIZE);
+    struct page * pgt_page = NULL;
 
+    if (pgts->num_pages == MAX_PGT_PAGES) {
+	printk(KERN_ERR "Error: Trampoline page tables need more than %d pages\n", MAX_PGT_PAGES);
+	return 0;
+    }
 
+    pgt_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
 
-    /* Map only first 2MB as identity  */
-    {
-	pml4e64_t   * pml        = __va(trampoline_state.pml_pa);
-	pdpe64_t    * pdp0       = __va(trampoline_state.pdp0_pa);
-	pde64_2MB_t * pd0        = __va(trampoline_state.pd0_pa);
+    if (pgt_page == NULL) {
+	printk(KERN_ERR "Error: Could not allocate page for trampoline page table\n");
+	return 0;
+    }
 
-	pml4e64_t   * pml_entry  = &(pml[0]);
-	pdpe64_t    * pdp_entry  = &(pdp0[0]);
-	pde64_2MB_t * pd_entry   = &(pd0[0]);
+    pgts->pages[pgts->num_pages++] = pgt_page;
 
-	pml_entry->present       = 1;
-	pml_entry->writable      = 1;
-	pml_entry->pdp_base_addr = PAGE_TO_BASE_ADDR(trampoline_state.pdp0_pa);
+    return (page_to_pfn(pgt_page) << PAGE_SHIFT);
+}
 
-	pdp_entry->present       = 1;
-	pdp_entry->writable      = 1;
-	pdp_entry->pd_base_addr  = PAGE_TO_BASE_ADDR(trampoline_state.pd0_pa);
 
-	pd_entry->present        = 1;
-	pd_entry->writable       = 1;
-	pd_entry->large_page     = 1;
-	pd_entry->page_base_addr = PAGE_TO_BASE_ADDR_2MB(0);
+/* 
+ * Maps [va, va + size) to pa. 
+ *  1GB pages are used wherever both addresses are 1GB aligned and the CPU supports them, 
+ *  2MB pages everywhere else. Existing mappings are left alone.
+ */
+static int
+map_pgt_range(struct enclave_pgts * pgts, 
+	      uintptr_t             va, 
+	      uintptr_t             pa, 
+	      u64                   size)
+{
+    pml4e64_t * pml     = __va(pgts->pml_pa);
+    int         gbpages = boot_cpu_has(X86_FEATURE_GBPAGES);
+
+    while (size > 0) {
+	pml4e64_t   * pml_entry = &(pml[PML4E64_INDEX(va)]);
+	pdpe64_t    * pdp_entry = NULL;
+	pde64_2MB_t * pd        = NULL;
+
+	if (!pml_entry->present) {
+	    uintptr_t pdp_pa = alloc_pgt_page(pgts);
+
+	    if (pdp_pa == 0) {
+		return -1;
+	    }
+
+	    pml_entry->present       = 1;
+	    pml_entry->writable      = 1;
+	    pml_entry->pdp_base_addr = PAGE_TO_BASE_ADDR(pdp_pa);
+	} 
+
+	pdp_entry = __va(BASE_TO_PAGE_ADDR(pml_entry->pdp_base_addr));
+	pdp_entry = &(pdp_entry[PDPE64_INDEX(va)]);
+
+	if ((gbpages)                     && 
+	    (!pdp_entry->present)         && 
+	    (PAGE_OFFSET_1GB(va) == 0)    && 
+	    (PAGE_OFFSET_1GB(pa) == 0)    &&
+	    (size >= PAGE_SIZE_1GB)) {
+	    pdpe64_1GB_t * large_entry = (pdpe64_1GB_t *)pdp_entry;
+
+	    large_entry->present        = 1;
+	    large_entry->writable       = 1;
+	    large_entry->large_page     = 1;
+	    large_entry->page_base_addr = PAGE_TO_BASE_ADDR_1GB(pa);
+
+	    va   += PAGE_SIZE_1GB;
+	    pa   += PAGE_SIZE_1GB;
+	    size -= PAGE_SIZE_1GB;
+	    continue;
+	}
 
+	if (!pdp_entry->present) {
+	    uintptr_t pd_pa = alloc_pgt_page(pgts);
+
+	    if (pd_pa == 0) {
+		return -1;
+	    }
+
+	    pdp_entry->present      = 1;
+	    pdp_entry->writable     = 1;
+	    pdp_entry->pd_base_addr = PAGE_TO_BASE_ADDR(pd_pa);
+	} else if (pdp_entry->large_page) {
+	    /* Already covered by a 1GB page */
+	    u64 skip = min_t(u64, size, PAGE_SIZE_1GB - PAGE_OFFSET_1GB(va));
+
+	    va   += skip;
+	    pa   += skip;
+	    size -= skip;
+	    continue;
+	}
+
+	pd = __va(BASE_TO_PAGE_ADDR(pdp_entry->pd_base_addr));
+
+	/* 2MB pages up to the end of this 1GB region */
+	do {
+	    pde64_2MB_t * pd_entry = &(pd[PDE64_INDEX(va)]);
+
+	    if (!pd_entry->present) {
+		pd_entry->present        = 1;
+		pd_entry->writable       = 1;
+		pd_entry->large_page     = 1;
+		pd_entry->page_base_addr = PAGE_TO_BASE_ADDR_2MB(pa);
+	    }
+
+	    va   += PAGE_SIZE_2MB;
+	    pa   += PAGE_SIZE_2MB;
+	    size -= PAGE_SIZE_2MB;
+	} while ((size > 0) && (PAGE_OFFSET_1GB(va) != 0));
     }
+
+    return 0;
 }
 
 
@@ -68,27 +174,6 @@ pisces_init_trampoline(void)
 
     memset(&trampoline_state, 0, sizeof(struct trampoline_data));
 
-    pgt_pages = alloc_pages(GFP_KERNEL, get_order(PAGE_SIZE * 7));
-
-    if (pgt_pages == NULL) {
-	printk(KERN_ERR "Error: Could not allocate pages for trampoline page table\n");
-	return -1;
-    }
-
-    trampoline_state.pml_pa  = (page_to_pfn(&(pgt_pages[0])) << PAGE_SHIFT);
-    trampoline_state.pdp0_pa = (page_to_pfn(&(pgt_pages[1])) << PAGE_SHIFT);
-    trampoline_state.pdp1_pa = (page_to_pfn(&(pgt_pages[2])) << PAGE_SHIFT);
-    trampoline_state.pdp2_pa = (page_to_pfn(&(pgt_pages[3])) << PAGE_SHIFT);
-    trampoline_state.pd0_pa  = (page_to_pfn(&(pgt_pages[4])) << PAGE_SHIFT);
-    trampoline_state.pd1_pa  = (page_to_pfn(&(pgt_pages[5])) << PAGE_SHIFT);
-    trampoline_state.pd2_pa  = (page_to_pfn(&(pgt_pages[6])) << PAGE_SHIFT);
-
-    /*
-     * Init trampoline PGTs 
-     */
-    init_trampoline_pgts();
-
-
     /* 
      * Call arch specific trampoline init
      */
@@ -101,161 +186,114 @@ pisces_deinit_trampoline(void)
 {
     deinit_trampoline();
 
-    __free_pages(pgt_pages, get_order(PAGE_SIZE * 7));
-
     return 0;
 }
 
 
-
-int 
-pisces_setup_trampoline(struct pisces_enclave * enclave) 
+/* 
+ * Builds the enclave's private copy of the trampoline page tables. 
+ * This happens outside the trampoline lock, so enclaves can be prepared concurrently
+ */
+int
+pisces_build_enclave_pgts(struct pisces_enclave * enclave)
 {
-    int ret = 0;
+    struct enclave_pgts * pgts = NULL;
+    u64 kern_map_size = enclave->bootmem_size;
 
-    if (enclave->bootmem_size % PAGE_SIZE_2MB) {
+    if ((enclave->bootmem_size % PAGE_SIZE_2MB) || 
+	(enclave->bootmem_addr_pa % PAGE_SIZE_2MB)) {
 	printk(KERN_ERR "Error: Bootmem must be at least 2MB granularity\n");
 	return -1;
     }
 
-    mutex_lock(&trampoline_lock);
-
-
-    /*
-     * Setup trampoline PGTs 
-     *  --  re-init pgts
-     *  --  identity map first 128MB of bootmem 
-     *  --  map 128MB of bootmem into kernel addresses 
-     */
-    init_trampoline_pgts();
-
-    {
-	pml4e64_t   * pml_entry = NULL;
-	pdpe64_t    * pdp_entry = NULL;
-	pde64_2MB_t * pd_entry  = NULL;
-
-	pml4e64_t   * pml = NULL;
-	pdpe64_t    * pdp = NULL;
-	pde64_2MB_t * pd  = NULL;
-	
-	uintptr_t base_addr = enclave->bootmem_addr_pa;
-	u32 num_pde_entries = (enclave->bootmem_size / PAGE_SIZE_2MB);
-	
-	int i = 0;
-
-	if (num_pde_entries > (MAX_PDE64_ENTRIES - PDE64_INDEX(base_addr))) {
-	    printk(KERN_ERR "Error: Overflow of identity mapped page tables by bootmem.");
-	    printk(KERN_ERR "\t Truncating mapping BUT THIS MAY FAIL spectacularly!!!\n");
-
-	    num_pde_entries = (MAX_PDE64_ENTRIES - PDE64_INDEX(base_addr));
-	}
-
-	pml       = (pml4e64_t  *)__va(trampoline_state.pml_pa);
-	pml_entry = &(pml[PML4E64_INDEX(base_addr)]);
-
-
-	if (!pml_entry->present) {
-	    pml_entry->present       = 1;
-	    pml_entry->writable      = 1;
-	    pml_entry->pdp_base_addr = PAGE_TO_BASE_ADDR(trampoline_state.pdp1_pa);
-	} 
-
-	pdp       = __va(BASE_TO_PAGE_ADDR(pml_entry->pdp_base_addr));
-	pdp_entry = &(pdp[PDPE64_INDEX(base_addr)]);
-
-
-	if (!pdp_entry->present) {
-	    pdp_entry->present      = 1;
-	    pdp_entry->writable     = 1;
-	    pdp_entry->pd_base_addr = PAGE_TO_BASE_ADDR(trampoline_state.pd1_pa);
-	}
+    if (enclave->boot_pgts != NULL) {
+	return 0;
+    }
 
-	pd  = __va(BASE_TO_PAGE_ADDR(pdp_entry->pd_base_addr));
+    pgts = kmalloc(sizeof(struct enclave_pgts), GFP_KERNEL);
 
+    if (pgts == NULL) {
+	printk(KERN_ERR "Error: Could not allocate enclave page table state\n");
+	return -1;
+    }
 
-	for (i = 0; i < num_pde_entries; i++) {
-	    pd_entry = &(pd[PDE64_INDEX(base_addr)]);
+    memset(pgts, 0, sizeof(struct enclave_pgts));
 
-	    if (!pd_entry->present) {
-		pd_entry->present        = 1;
-		pd_entry->writable       = 1;
-		pd_entry->large_page     = 1;
-		pd_entry->page_base_addr = PAGE_TO_BASE_ADDR_2MB(base_addr);
-	    }
+    pgts->pml_pa = alloc_pgt_page(pgts);
 
-	    base_addr += PAGE_SIZE_2MB;
-	}
-	
+    if (pgts->pml_pa == 0) {
+	goto err;
     }
 
+    /* Only the top 2GB of the address space is available for the kernel map */
+    if (kern_map_size > (0ULL - KERN_VA_BASE)) {
+	printk(KERN_WARNING "Warning: Only mapping the first 2GB of bootmem into the kernel address space\n");
+	kern_map_size = (0ULL - KERN_VA_BASE);
+    }
 
+    /*
+     * Setup trampoline PGTs 
+     *  --  identity map first 2MB (trampoline)
+     *  --  identity map bootmem 
+     *  --  map bootmem into kernel addresses 
+     */
+    if ((map_pgt_range(pgts, 0, 0, PAGE_SIZE_2MB) != 0) ||
+	(map_pgt_range(pgts, enclave->bootmem_addr_pa, enclave->bootmem_addr_pa, enclave->bootmem_size) != 0) ||
+	(map_pgt_range(pgts, KERN_VA_BASE, enclave->bootmem_addr_pa, kern_map_size) != 0)) {
+	printk(KERN_ERR "Error: Could not map bootmem into trampoline page tables\n");
+	goto err;
+    }
 
-    {
-#define KERN_VA_BASE 0xffffffff80000000ULL
-
-	pml4e64_t   * pml_entry = NULL;
-	pdpe64_t    * pdp_entry = NULL;
-	pde64_2MB_t * pd_entry  = NULL;
-
-	pml4e64_t   * pml = NULL;
-	pdpe64_t    * pdp = NULL;
-	pde64_2MB_t * pd  = NULL;
-	
-	uintptr_t kern_addr    = KERN_VA_BASE;
-	uintptr_t bootmem_addr = enclave->bootmem_addr_pa;
-	u32 num_pde_entries    = (enclave->bootmem_size / PAGE_SIZE_2MB);
-	
-	int i = 0;
+    printk(KERN_DEBUG "Trampoline page tables use %u pages (1GB pages %s)\n", 
+	   pgts->num_pages, (boot_cpu_has(X86_FEATURE_GBPAGES)) ? "enabled" : "unavailable");
 
+    // walk_pgtables((uintptr_t)__va(pgts->pml_pa));
 
-	if (num_pde_entries > (MAX_PDE64_ENTRIES - PDE64_INDEX(kern_addr))) {
-	    printk(KERN_ERR "Error: Overflow of kernel VA space page tables by bootmem.");
-	    printk(KERN_ERR "\t Truncating mapping BUT THIS MAY FAIL spectacularly!!!\n");
+    enclave->boot_pgts = pgts;
 
-	    num_pde_entries = (MAX_PDE64_ENTRIES - PDE64_INDEX(kern_addr));
-	}
+    return 0;
 
+ err:
+    while (pgts->num_pages > 0) {
+	__free_page(pgts->pages[--pgts->num_pages]);
+    }
 
-	pml       = (pml4e64_t  *)__va(trampoline_state.pml_pa);
-	pml_entry = &(pml[PML4E64_INDEX(kern_addr)]);
+    kfree(pgts);
 
+    return -1;
+}
 
-	if (!pml_entry->present) {
-	    pml_entry->present       = 1;
-	    pml_entry->writable      = 1;
-	    pml_entry->pdp_base_addr = PAGE_TO_BASE_ADDR(trampoline_state.pdp2_pa);
-	} 
 
-	pdp       = __va(BASE_TO_PAGE_ADDR(pml_entry->pdp_base_addr));
-	pdp_entry = &(pdp[PDPE64_INDEX(kern_addr)]);
+void
+pisces_free_enclave_pgts(struct pisces_enclave * enclave)
+{
+    struct enclave_pgts * pgts = enclave->boot_pgts;
 
+    if (pgts == NULL) {
+	return;
+    }
 
-	if (!pdp_entry->present) {
-	    pdp_entry->present      = 1;
-	    pdp_entry->writable     = 1;
-	    pdp_entry->pd_base_addr = PAGE_TO_BASE_ADDR(trampoline_state.pd2_pa);
-	}
+    while (pgts->num_pages > 0) {
+	__free_page(pgts->pages[--pgts->num_pages]);
+    }
 
-	pd  = __va(BASE_TO_PAGE_ADDR(pdp_entry->pd_base_addr));
+    kfree(pgts);
 
+    enclave->boot_pgts = NULL;
+}
 
-	for (i = 0; i < num_pde_entries; i++) {
-	    pd_entry = &(pd[PDE64_INDEX(kern_addr)]);
 
-	    if (!pd_entry->present) {
-		pd_entry->present        = 1;
-		pd_entry->writable       = 1;
-		pd_entry->large_page     = 1;
-		pd_entry->page_base_addr = PAGE_TO_BASE_ADDR_2MB(bootmem_addr);
-	    }
 
-	    kern_addr    += PAGE_SIZE_2MB;
-	    bootmem_addr += PAGE_SIZE_2MB;
-	}
+int 
+pisces_setup_trampoline(struct pisces_enclave * enclave) 
+{
+    int ret = 0;
 
+    if (pisces_build_enclave_pgts(enclave) != 0) {
+	return -1;
     }
 
-    // walk_pgtables((uintptr_t)__va(trampoline_state.pml_pa));
+    mutex_lock(&trampoline_lock);
 
     ret = setup_enclave_trampoline(enclave);
 
@@ -295,6 +333,7 @@ set_enclave_launch_args(struct pisces_enclave * enclave,
 
     boot_params->launch_code_esi         = esi;
     boot_params->launch_code_target_addr = target_addr;
+    boot_params->launch_code_cr3         = enclave->boot_pgts->pml_pa;
 
     printk(KERN_DEBUG "  set target address at %p to %p\n", 
 	   (void *) __pa(&(boot_params->launch_code_target_addr)), 
@@ -308,6 +347,35 @@ set_enclave_launch_args(struct pisces_enclave * enclave,
 
 
 
+/* 
+ * Modern CPUs don't need the legacy INIT/SIPI delays 
+ * (matches the detection in Linux's smpboot.c) 
+ */
+static int
+get_init_udelay(void)
+{
+    if (init_udelay >= 0) {
+	return init_udelay;
+    }
+
+    if (((boot_cpu_data.x86_vendor == X86_VENDOR_INTEL) && (boot_cpu_data.x86 >= 6)) ||
+	((boot_cpu_data.x86_vendor == X86_VENDOR_AMD)   && (boot_cpu_data.x86 >= 0xF))) {
+	return 0;
+    }
+
+    return 10000;
+}
+
+static void
+init_delay(int usecs)
+{
+    if (usecs > 0) {
+	mdelay(usecs / 1000);
+	udelay(usecs % 1000);
+    }
+}
+
+
 static int 
 __lapic_get_maxlvt(void)
 {
@@ -325,6 +393,7 @@ __wakeup_secondary_cpu_via_init(int phys_apicid)
 {
         unsigned long send_status, accept_status = 0;
         int maxlvt, num_starts, j;
+        int init_usecs = get_init_udelay();
 
         maxlvt = __lapic_get_maxlvt();
 
@@ -351,7 +420,7 @@ __wakeup_secondary_cpu_via_init(int phys_apicid)
         pr_debug("Waiting for send to finish...\n");
         send_status = safe_apic_wait_icr_idle();
 
-        mdelay(10);
+        init_delay(init_usecs);
 
         pr_debug("Deasserting INIT\n");
 
@@ -414,7 +483,7 @@ __wakeup_secondary_cpu_via_init(int phys_apicid)
                 /*
                  * Give the other CPU some time to accept the IPI.
                  */
-                udelay(300);
+                udelay((init_usecs == 0) ? 10 : 300);
 
                 pr_debug("Startup point 1\n");
 
@@ -424,7 +493,7 @@ __wakeup_secondary_cpu_via_init(int phys_apicid)
                 /*
                  * Give the other CPU some time to accept the IPI.
                  */
-                udelay(200);
+                udelay((init_usecs == 0) ? 10 : 200);
                 if (maxlvt > 3)         /* Due to the Pentium erratum 3AP.  */
                        apic_write(APIC_ESR, 0);
                 accept_status = (apic_read(APIC_ESR) & 0xEF);
@@ -444,32 +513,146 @@ __wakeup_secondary_cpu_via_init(int phys_apicid)
 
 
 
+static irqreturn_t
+boot_notify_handler(int    irq, 
+		    void * priv_data)
+{
+    struct completion * boot_done = priv_data;
+
+    complete(boot_done);
+
+    return IRQ_HANDLED;
+}
+
+
+/* 
+ * Sleep until the enclave CPU sets initialized. 
+ *   If a notification IRQ is available the enclave's IPI wakes us immediately,
+ *   otherwise (or if the enclave does not send one) the flag is polled.
+ */
+static int
+wait_for_enclave_cpu(struct pisces_boot_params * boot_params, 
+		     struct completion         * boot_done, 
+		     int                         notify_irq)
+{
+    ktime_t start_time = ktime_get();
+    s64     timeout_ns = (s64)BOOT_TIMEOUT_MS * NSEC_PER_MSEC;
+
+    while (boot_params->initialized != 1) {
+
+	if (ktime_to_ns(ktime_sub(ktime_get(), start_time)) > timeout_ns) {
+	    return -1;
+	}
+
+	if (notify_irq >= 0) {
+	    wait_for_completion_timeout(boot_done, 1);
+	} else {
+	    usleep_range(BOOT_POLL_US, 2 * BOOT_POLL_US);
+	}
+    }
+
+    printk("Enclave CPU initialized after %lld usecs\n", 
+	   (s64)ktime_to_us(ktime_sub(ktime_get(), start_time)));
+
+    return 0;
+}
+
+
+/* 
+ * Wait for num_cpus enclave CPUs to pass through the launch code. 
+ * After that they run on the enclave's own page tables and the Linux trampoline can be released
+ */
+static int
+wait_for_enclave_launch(struct pisces_boot_params * boot_params, 
+			u32                         launch_count, 
+			u32                         num_cpus)
+{
+    ktime_t start_time = ktime_get();
+    s64     timeout_ns = (s64)BOOT_TIMEOUT_MS * NSEC_PER_MSEC;
+
+    while ((u32)(boot_params->launch_code_count - launch_count) < num_cpus) {
+
+	if (ktime_to_ns(ktime_sub(ktime_get(), start_time)) > timeout_ns) {
+	    return -1;
+	}
+
+	usleep_range(LAUNCH_POLL_US, 2 * LAUNCH_POLL_US);
+    }
+
+    return 0;
+}
+
+
 int 
 boot_enclave(struct pisces_enclave * enclave) 
 {
     struct pisces_boot_params * boot_params = (struct pisces_boot_params *)__va(enclave->bootmem_addr_pa);
+    struct completion           boot_done;
 
-    int apicid = apic->cpu_present_to_apicid(enclave->boot_cpu);
-    int cpuid  = 0;
-    int ret    = 0;
+    int apicid       = apic->cpu_present_to_apicid(enclave->boot_cpu);
+    int cpuid        = 0;
+    int notify_irq   = -1;
+    u32 launch_count = 0;
+    u32 res_cpus     = 0;
+    int ret          = 0;
 
     printk(KERN_DEBUG "Boot Enclave on CPU %d (APIC=%d)...\n", 
 	   enclave->boot_cpu, apicid);
 
+    /* Everything up to the SIPI is prepared without holding the trampoline */
+    if (pisces_build_enclave_pgts(enclave) != 0) {
+	printk(KERN_ERR "Error: Could not build trampoline page tables for enclave\n");
+	return -1;
+    }
+
     set_enclave_launch_args(enclave,
 			    boot_params->kernel_addr,
 			    enclave->bootmem_addr_pa >> PAGE_SHIFT);
 
+    launch_count = boot_params->launch_code_count;
 
+    /* CPUs in the launch resource list also come in through the Linux trampoline */
+    if (boot_params->launch_res_addr) {
+	struct pisces_launch_res * res = __va(boot_params->launch_res_addr);
 
-    if (pisces_setup_trampoline(enclave) != 0) {
-	printk(KERN_ERR "Error: Could not setup trampoline for enclave\n");
-	return -1;
+	res_cpus = res->num_cpus;
     }
 
     /* Preempt-safe method for getting cpuid */
     cpuid = get_cpu();
     put_cpu();
+
+    /* Ask the enclave to signal its initialization with an IPI */
+    init_completion(&boot_done);
+
+    notify_irq = pisces_request_irq(boot_notify_handler, &boot_done);
+
+    if (notify_irq >= 0) {
+	int vector = pisces_irq_to_vector(notify_irq);
+
+	if (vector < 0) {
+	    pisces_release_irq(notify_irq, &boot_done);
+	    notify_irq = -1;
+	} else {
+	    /* Same target as the lcall IPIs */
+	    boot_params->boot_notify_apicid = apic->cpu_present_to_apicid(0);
+	    boot_params->boot_notify_vector = vector;
+	}
+    }
+
+    if (notify_irq < 0) {
+	printk(KERN_WARNING "Could not allocate boot notification IRQ, polling for enclave CPU\n");
+	boot_params->boot_notify_vector = 0;
+    }
+
+
+    if (pisces_setup_trampoline(enclave) != 0) {
+	printk(KERN_ERR "Error: Could not setup trampoline for enclave\n");
+	ret = -1;
+	goto out;
+    }
+
+    pisces_boot_mark(enclave, PISCES_BOOT_TRAMPOLINE_DONE);
 	
     printk(KERN_INFO "Reset APIC %d from APIC %d (CPU=%d)\n", 
 	   apicid,
@@ -477,21 +660,32 @@ boot_enclave(struct pisces_enclave * enclave)
 	
     __wakeup_secondary_cpu_via_init(apicid);
 
+    pisces_boot_mark(enclave, PISCES_BOOT_SIPI_SENT);
+
+    if (wait_for_enclave_launch(boot_params, launch_count, 1) != 0) {
+	printk(KERN_ERR "Error: Enclave CPU never reached the launch code\n");
+	ret = -1;
+    }
+
+    if ((ret == -1) || (res_cpus == 0)) {
+	pisces_restore_trampoline(enclave);
+    }
+
+    if (ret == -1) {
+	goto out;
+    }
 	
     /* Wait for the target CPU to come up */
     {
-	int i = 0;
+	wait_for_enclave_cpu(boot_params, &boot_done, notify_irq);
 
-	for (i = 0; i < 15; i++) {
-	    if (boot_params->initialized == 1) {
-		break;
-	    }
-
-	    printk("...Waiting (%d)\n", i);
-	    mdelay(100);
+	if (notify_irq >= 0) {
+	    boot_params->boot_notify_vector = 0;
+	    pisces_release_irq(notify_irq, &boot_done);
 	}
 	
 	if (boot_params->initialized == 1) {
+	    pisces_boot_mark(enclave, PISCES_BOOT_CPU_INITIALIZED);
 	    printk("Enclave CPU has initialized\n");
 	} else {
 	    printk(KERN_ERR "Error: Enclave CPU timed out\n");
@@ -504,7 +698,25 @@ boot_enclave(struct pisces_enclave * enclave)
 
     }	
 
-    pisces_restore_trampoline(enclave);
+    if (res_cpus > 0) {
+	/* Enclaves that don't add the launch resources themselves get them through ctrl commands */
+	if ((ret == 0) && (boot_params->resources_added)) {
+	    if (wait_for_enclave_launch(boot_params, launch_count, 1 + res_cpus) != 0) {
+		printk(KERN_ERR "Error: Only %u of %u launch CPUs reached the launch code\n", 
+		       boot_params->launch_code_count - launch_count - 1, res_cpus);
+	    }
+	}
+
+	pisces_restore_trampoline(enclave);
+    }
+
+    return ret;
+
+ out:
+    if (notify_irq >= 0) {
+	boot_params->boot_notify_vector = 0;
+	pisces_release_irq(notify_irq, &boot_done);
+    }
 
     return ret;
 }
@@ -521,6 +733,7 @@ stop_enclave(struct pisces_enclave * enclave)
 
 	unsigned long send_status = 0;
 	int maxlvt;
+	int init_usecs = get_init_udelay();
 
 	maxlvt = __lapic_get_maxlvt();
 	    
@@ -550,7 +763,7 @@ stop_enclave(struct pisces_enclave * enclave)
 	pr_debug("Waiting for send to finish...\n");
 	send_status = safe_apic_wait_icr_idle();
 
-	mdelay(10);
+	init_delay(init_usecs);
 
 	pr_debug("Deasserting INIT\n");
 
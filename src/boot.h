@@ -4,21 +4,27 @@
 #include "pgtables.h"
 
 struct trampoline_data {
-    uintptr_t pml_pa;
-
-    uintptr_t pdp0_pa;   /* < 1GB identity map (trampoline) */
-    uintptr_t pdp1_pa;   /* > 1GB identity map (bootmem)    */
-    uintptr_t pdp2_pa;   /* Kernel address map (bootmem)    */   
-
-    uintptr_t pd0_pa;     /* < 1GB identity map (trampoline) */
-    uintptr_t pd1_pa;     /* > 1GB identity map (bootmem)    */
-    uintptr_t pd2_pa;     /* Kernel address map (bootmem)    */  
-
     unsigned long cpu_init_rip;  
 } __attribute__((aligned(PAGE_SIZE))) __attribute__((packed));
 
 extern struct trampoline_data trampoline_state;
 
+
+/* 
+ * Page tables used by an enclave's CPUs on their way through the Linux trampoline
+ *  -- Identity map of the first 2MB (trampoline)
+ *  -- Identity map of bootmem 
+ *  -- Kernel address map of bootmem
+ */
+#define MAX_PGT_PAGES 64   /* Enough for ~56GB of bootmem if the CPU lacks 1GB pages */
+
+struct enclave_pgts {
+    uintptr_t     pml_pa;
+
+    struct page * pages[MAX_PGT_PAGES];     /* Every page table page, including the PML */
+    u32           num_pages;
+};
+
 int boot_enclave(struct pisces_enclave * enclave);
 int stop_enclave(struct pisces_enclave * enclave);
 
@@ -26,6 +32,9 @@ int stop_enclave(struct pisces_enclave * enclave);
 int pisces_init_trampoline(void);
 int pisces_deinit_trampoline(void);
 
+int  pisces_build_enclave_pgts(struct pisces_enclave * enclave);
+void pisces_free_enclave_pgts(struct pisces_enclave * enclave);
+
 int pisces_setup_trampoline(struct pisces_enclave * enclave);
 int pisces_restore_trampoline(struct pisces_enclave * enclave);
 
@@ -53,6 +53,12 @@ struct pisces_resp {
 #define PISCES_CMD_VM_CONS_CONNECT    150
 #define PISCES_CMD_VM_CONS_DISCONNECT 151
 #define PISCES_CMD_VM_CONS_KEYCODE    152  /* Not accessible via an IOCTL */
+#define PISCES_CMD_VM_CONS_KEYCODES   153  /* Not accessible via an IOCTL */
+
+/* IOCTLs on the VM console fd returned by PISCES_CMD_VM_CONS_CONNECT */
+#define PISCES_VM_CONS_RING_INFO      160
+#define PISCES_VM_CONS_SET_EVENTFD    161
+#define PISCES_VM_CONS_CONSUME        162
 
 #define PISCES_CMD_ADD_V3_PCI         180
 #define PISCES_CMD_ADD_V3_SATA        181
@@ -62,6 +68,8 @@ struct pisces_resp {
 #define PISCES_CMD_LAUNCH_JOB         200
 #define PISCES_CMD_LOAD_FILE          201
 #define PISCES_CMD_STORE_FILE         202
+#define PISCES_CMD_STAGE_FILE         203
+#define PISCES_CMD_STAGE_FILE_DONE    204  /* Not accessible via an IOCTL */
 
 
 #define PISCES_CMD_XPMEM_CMD_EX       300
@@ -132,6 +140,42 @@ struct pisces_file_pair {
 } __attribute__((packed));
 
 
+/* Host driven file transfer. 
+ * bytes and usecs are filled in by the kernel on return 
+ */
+#define PISCES_STAGE_LOAD  0   /* Linux -> Enclave */
+#define PISCES_STAGE_STORE 1   /* Enclave -> Linux */
+
+struct pisces_stage_file {
+    struct pisces_file_pair file_pair;
+    u32 direction;
+    u64 bytes;
+    u64 usecs;
+} __attribute__((packed));
+
+
+
+/* Describes the VM console ring for consumers that mmap() the console fd
+ *  Offsets are in bytes from the start of the ring. The mapping is read-only, and is
+ *  refused if the ring does not start on a page boundary.
+ *  To consume: handle the first *cur_entries messages starting at msgs[*read_idx] (modulo
+ *  total_entries), then pass the number handled to PISCES_VM_CONS_CONSUME. That ioctl moves
+ *  read_idx and cur_entries under the ring lock and returns how many it dropped.
+ *  Reading messages without the ring lock relies on Palacios storing each message before
+ *  its locked increment of cur_entries, so entries counted in cur_entries are complete.
+ *  Don't mix this with read() on the same console.
+ */
+struct vm_cons_ring_info {
+    u64 mmap_size;           /* Bytes to map at offset 0 */
+    u32 ring_offset;         /* Start of the ring in the mapping */
+    u32 read_idx_offset;
+    u32 write_idx_offset;
+    u32 cur_entries_offset;
+    u32 msgs_offset;
+    u32 total_entries;
+    u32 msg_size;
+} __attribute__((packed));
+
 
 /* Kernel Space command Structures */
 #ifdef __KERNEL__
@@ -173,6 +217,15 @@ struct cmd_vm_cons_keycode {
     u8  scan_code;
 } __attribute__((packed));
 
+#define PISCES_MAX_VM_CONS_KEYCODES 256
+
+struct cmd_vm_cons_keycodes {
+    struct pisces_cmd     hdr;
+    u32 vm_id;
+    u32 num_codes;
+    u8  scan_codes[0];
+} __attribute__((packed));
+
 
 struct cmd_vm_debug {
     struct pisces_cmd      hdr;
@@ -213,6 +266,40 @@ struct cmd_store_file {
 } __attribute__((packed));
 
 
+/* For a load, file_size is the size of the Linux file and the enclave allocates
+ *   buffers to hold it. For a store, file_size is ignored and the enclave 
+ *   returns the buffers holding the file contents.
+ *
+ * The response data is a struct stage_file_resp. The buffers are in file order.
+ */
+struct cmd_stage_file {
+    struct pisces_cmd       hdr;
+    struct pisces_file_pair file_pair;
+    u32 direction;
+    u64 file_size;
+} __attribute__((packed));
+
+struct pisces_stage_desc {
+    u64 phys_addr;
+    u64 size;
+} __attribute__((packed));
+
+struct stage_file_resp {
+    u64 file_size;
+    u32 num_descs;
+    struct pisces_stage_desc descs[0];
+} __attribute__((packed));
+
+/* Sent after the copy finishes (or fails) so the enclave can commit or release the buffers */
+struct cmd_stage_file_done {
+    struct pisces_cmd       hdr;
+    struct pisces_file_pair file_pair;
+    u32 direction;
+    u64 bytes;
+    s64 status;
+} __attribute__((packed));
+
+
 #endif
 
 /* ** */
@@ -24,6 +24,7 @@
 #include "boot.h"
 #include "pisces_boot_params.h"
 #include "pisces_xpmem.h"
+#include "pisces_scrub.h"
 
 
 #include "pgtables.h"
@@ -36,31 +37,48 @@ extern int                     pisces_major_num;
 
 struct pisces_enclave * enclave_map[MAX_ENCLAVES] = {[0 ... MAX_ENCLAVES - 1] = 0};
 
+/* Protects enclave_map, and changes to the enclaves' CPU masks and memory lists 
+ *  Taken inside an enclave's op_lock, never the other way around
+ */
+static DEFINE_MUTEX(enclave_map_lock);
+
 static int 
 alloc_enclave_index(struct pisces_enclave * enclave) 
 {
-    int i = 0;
+    int ret = -1;
+    int i   = 0;
 
-    for (i = 0; i < MAX_ENCLAVES; i++) {
-        if (enclave_map[i] == NULL) {
-            enclave_map[i] = enclave;
-            return i;
-        }
+    mutex_lock(&enclave_map_lock);
+    {
+	for (i = 0; i < MAX_ENCLAVES; i++) {
+	    if (enclave_map[i] == NULL) {
+		enclave_map[i] = enclave;
+		ret = i;
+		break;
+	    }
+	}
     }
+    mutex_unlock(&enclave_map_lock);
 
-    return -1;
+    return ret;
 }
 
 
 static void 
 free_enclave_index(int idx) 
 {
-    enclave_map[idx] = NULL;
+    mutex_lock(&enclave_map_lock);
+    {
+	enclave_map[idx] = NULL;
+    }
+    mutex_unlock(&enclave_map_lock);
 }
 
 
 
 static int pisces_enclave_launch(struct pisces_enclave * enclave);
+static void pisces_enclave_remove_cpu(struct pisces_enclave * enclave, u32 cpu_id);
+static void pisces_enclave_remove_mem(struct pisces_enclave * enclave, u64 base_addr);
 
 
 
@@ -136,12 +154,21 @@ enclave_ioctl(struct file  * filp,
 			break;
 		    }
 
+		    if ((boot_env.console_ring_size != 0) &&
+			(pisces_cons_check_size(boot_env.console_ring_size) != 0)) {
+			printk(KERN_ERR "Invalid console ring size (%llu)\n", boot_env.console_ring_size);
+			ret = -EINVAL;
+			break;
+		    }
+
 		    num_pages = (boot_env.num_blocks * boot_env.block_size) / PAGE_SIZE;
 		    
 		    /* We need to check that these values are legit */
 		    enclave->bootmem_addr_pa =  boot_env.base_addr;
 		    enclave->bootmem_size    =  num_pages * PAGE_SIZE;
 		    enclave->boot_cpu        =  boot_env.cpu_id;
+
+		    enclave->console_ring_size = boot_env.console_ring_size;
 		    
 		    pisces_enclave_add_cpu(enclave, boot_env.cpu_id);
 
@@ -161,6 +188,148 @@ enclave_ioctl(struct file  * filp,
 		    
 		    ret = pisces_enclave_launch(enclave);
 		    
+		    break;
+		}
+	    case PISCES_ENCLAVE_LAUNCH_RES:
+		{
+		    struct enclave_launch_res   launch_res;
+		    struct pisces_mem_range   * ranges = NULL;
+		    u32                       * cpus   = NULL;
+		    int i = 0;
+		    
+		    memset(&launch_res, 0, sizeof(struct enclave_launch_res));
+		    
+		    if (copy_from_user(&launch_res, argp, sizeof(struct enclave_launch_res))) {
+			printk(KERN_ERR "Error copying launch resources from user space\n");
+			ret = -EFAULT;
+			break;
+		    }
+
+		    if (enclave->state != ENCLAVE_LOADED) {
+			printk(KERN_ERR "Enclave %d has already been launched\n", enclave->id);
+			ret = -EBUSY;
+			break;
+		    }
+
+		    if ((launch_res.num_cpus       == 0) || (launch_res.num_cpus       > nr_cpu_ids) ||
+			(launch_res.num_mem_ranges == 0) || (launch_res.num_mem_ranges > 4096)) {
+			printk(KERN_ERR "Invalid launch resources (%u CPUs, %u memory ranges)\n", 
+			       launch_res.num_cpus, launch_res.num_mem_ranges);
+			ret = -EINVAL;
+			break;
+		    }
+
+		    if ((launch_res.console_ring_size != 0) &&
+			(pisces_cons_check_size(launch_res.console_ring_size) != 0)) {
+			printk(KERN_ERR "Invalid console ring size (%llu)\n", launch_res.console_ring_size);
+			ret = -EINVAL;
+			break;
+		    }
+
+		    enclave->console_ring_size = launch_res.console_ring_size;
+
+		    cpus   = kmalloc(launch_res.num_cpus       * sizeof(u32),                     GFP_KERNEL);
+		    ranges = kmalloc(launch_res.num_mem_ranges * sizeof(struct pisces_mem_range), GFP_KERNEL);
+
+		    if ((!cpus) || (!ranges)) {
+			kfree(cpus);
+			kfree(ranges);
+			ret = -ENOMEM;
+			break;
+		    }
+
+		    if (copy_from_user(cpus,   (void __user *)(uintptr_t)launch_res.cpus,       
+				       launch_res.num_cpus       * sizeof(u32)) || 
+			copy_from_user(ranges, (void __user *)(uintptr_t)launch_res.mem_ranges, 
+				       launch_res.num_mem_ranges * sizeof(struct pisces_mem_range))) {
+			printk(KERN_ERR "Error copying launch resource lists from user space\n");
+			kfree(cpus);
+			kfree(ranges);
+			ret = -EFAULT;
+			break;
+		    }
+
+		    /* Enclave CPUs must be offlined from Linux first */
+		    for (i = 0; i < launch_res.num_cpus; i++) {
+			if ((cpus[i] >= nr_cpu_ids) || (!cpu_present(cpus[i])) || (cpu_online(cpus[i]))) {
+			    printk(KERN_ERR "Invalid launch CPU %u (must be present and offline)\n", cpus[i]);
+			    ret = -EINVAL;
+			}
+		    }
+
+		    for (i = 0; i < launch_res.num_mem_ranges; i++) {
+			if ((ranges[i].base_addr & ~PAGE_MASK) || (ranges[i].pages == 0) || (ranges[i].pages > 0xffffffffULL) ||
+			    (ranges[i].base_addr + (ranges[i].pages * PAGE_SIZE) < ranges[i].base_addr) ||
+			    (pisces_scrub_check_offline(ranges[i].base_addr, ranges[i].pages * PAGE_SIZE) != 0)) {
+			    printk(KERN_ERR "Invalid launch memory range [%p, %llu pages]\n", 
+				   (void *)ranges[i].base_addr, ranges[i].pages);
+			    ret = -EINVAL;
+			}
+		    }
+
+		    if (ret == 0) {
+			u32 cpus_added = 0;
+			u32 mem_added  = 0;
+			int launched   = 0;
+
+			/* These fail for CPUs and memory another enclave (or this one) already owns, 
+			 * which also catches duplicate and overlapping entries in the lists 
+			 */
+			for (cpus_added = 0; cpus_added < launch_res.num_cpus; cpus_added++) {
+			    if (pisces_enclave_add_cpu(enclave, cpus[cpus_added]) != 0) {
+				ret = -EBUSY;
+				break;
+			    }
+			}
+
+			for (mem_added = 0; (ret == 0) && (mem_added < launch_res.num_mem_ranges); mem_added++) {
+			    if (pisces_enclave_add_mem(enclave, ranges[mem_added].base_addr, ranges[mem_added].pages) != 0) {
+				ret = -EBUSY;
+				break;
+			    }
+			}
+
+			if (ret == 0) {
+			    /* The first CPU and memory range are the boot resources */
+			    enclave->bootmem_addr_pa = ranges[0].base_addr;
+			    enclave->bootmem_size    = ranges[0].pages * PAGE_SIZE;
+			    enclave->boot_cpu        = cpus[0];
+
+			    printk(KERN_DEBUG "Launch Pisces Enclave (cpu=%d) (bootmem=%p) with %u CPUs and %u memory ranges\n", 
+				   enclave->boot_cpu, 
+				   (void *)enclave->bootmem_addr_pa, 
+				   launch_res.num_cpus, launch_res.num_mem_ranges);
+
+			    ret      = pisces_enclave_launch(enclave);
+			    launched = 1;
+			}
+
+			if (ret != 0) {
+			    if (launched) {
+				/* A CPU may have been started and timed out, it can't keep running in
+				 * memory we are about to give away. INIT is harmless to CPUs that never 
+				 * got a SIPI.
+				 */
+				stop_enclave(enclave);
+
+				/* The page tables map this bootmem, a retry may pass another one */
+				pisces_free_enclave_pgts(enclave);
+			    }
+
+			    /* Hand back everything this call assigned */
+			    while (mem_added > 0) {
+				pisces_enclave_remove_mem(enclave, ranges[--mem_added].base_addr);
+			    }
+
+			    while (cpus_added > 0) {
+				pisces_enclave_remove_cpu(enclave, cpus[--cpus_added]);
+			    }
+			}
+		    }
+
+		    kfree(cpus);
+		    kfree(ranges);
+
 		    break;
 		}
 	    case PISCES_ENCLAVE_RESET:
@@ -192,52 +361,6 @@ enclave_ioctl(struct file  * filp,
 
 		    // readd resources
 		    {
-
-			/* Memory */
-			{
-			    struct enclave_mem_block * iter    = NULL;
-			    struct memory_range reg;
-
-			    list_for_each_entry(iter, &(enclave->memdesc_list), node) 
-			    {
-
-				if ((iter->base_addr >= enclave->bootmem_addr_pa) && 
-				    (iter->base_addr <  (enclave->bootmem_addr_pa + enclave->bootmem_size))) {
-				    /* Don't add boot memory */
-				    continue;
-				} 
-
-				memset(&reg, 0, sizeof(struct memory_range));
-			
-				reg.base_addr = iter->base_addr;
-				reg.pages     = iter->pages;
-
-				if (ctrl_add_mem(enclave, &reg) != 0) {
-				    printk(KERN_ERR "Error: Could not readd memory [%p] after reset\n",
-					   (void *)reg.base_addr);
-				}
-			    }
-			    
-			}
-
-
-			/* CPUs */
-			{
-			    u64 cpu_id = 0;
-
-			    for_each_cpu(cpu_id, &(enclave->assigned_cpus)) {
-
-				/* Don't add the boot CPU */
-				if (cpu_id == enclave->boot_cpu) continue;
-
-				if (ctrl_add_cpu(enclave, cpu_id) != 0) {
-				    printk(KERN_ERR "Error: Could not readd CPU [%llu] after reset\n",
-					   cpu_id);
-				}
-			    }
-			
-			}
-			
 			/* PCI Devices */
 			{
 			    struct pisces_pci_dev * dev = NULL;
@@ -426,6 +549,72 @@ proc_pci_open(struct inode * inode,
 
 
 
+static int 
+proc_io_show(struct seq_file * file, 
+	     void            * priv_data)
+{
+    struct pisces_enclave * enclave = file->private;
+
+    if (IS_ERR(enclave)) {
+	seq_printf(file, "NULL ENCLAVE\n");
+	return 0;
+    }
+
+    enclave_fs_show_stats(file, enclave);
+
+    return 0;
+}
+
+static int 
+proc_io_open(struct inode * inode, 
+	     struct file  * filp) 
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
+    struct pisces_enclave * enclave = PDE(inode)->data;
+#else 
+    struct pisces_enclave * enclave = PDE_DATA(inode);
+#endif
+
+    enclave_get(enclave);
+
+    return single_open(filp, proc_io_show, enclave);
+}
+
+
+
+static int 
+proc_boot_timeline_show(struct seq_file * file, 
+			void            * priv_data)
+{
+    struct pisces_enclave * enclave = file->private;
+
+    if (IS_ERR(enclave)) {
+	seq_printf(file, "NULL ENCLAVE\n");
+	return 0;
+    }
+
+    pisces_boot_timeline_show(file, enclave);
+
+    return 0;
+}
+
+static int 
+proc_boot_timeline_open(struct inode * inode, 
+			struct file  * filp) 
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
+    struct pisces_enclave * enclave = PDE(inode)->data;
+#else 
+    struct pisces_enclave * enclave = PDE_DATA(inode);
+#endif
+
+    enclave_get(enclave);
+
+    return single_open(filp, proc_boot_timeline_show, enclave);
+}
+
+
+
 static struct file_operations enclave_fops = {
     .owner          = THIS_MODULE,
     .unlocked_ioctl = enclave_ioctl,
@@ -480,6 +669,24 @@ static struct file_operations proc_pci_fops = {
 };
 
 
+static struct file_operations proc_io_fops = {
+    .owner   = THIS_MODULE, 
+    .open    = proc_io_open,
+    .read    = seq_read,
+    .llseek  = seq_lseek,
+    .release = proc_release,
+};
+
+
+static struct file_operations proc_boot_timeline_fops = {
+    .owner   = THIS_MODULE, 
+    .open    = proc_boot_timeline_open,
+    .read    = seq_read,
+    .llseek  = seq_lseek,
+    .release = proc_release,
+};
+
+
 
 
 int 
@@ -526,7 +733,13 @@ pisces_enclave_create(struct pisces_image * img)
     
     INIT_LIST_HEAD(&(enclave->memdesc_list));
 
-    init_enclave_fs(enclave);
+    if (init_enclave_fs(enclave) != 0) {
+	printk(KERN_ERR "Could not initialize enclave file system state\n");
+	free_enclave_index(enclave_idx);
+	kfree(enclave);
+	return -1;
+    }
+
     init_enclave_pci(enclave);
 
     enclave->dev          = MKDEV(pisces_major_num, enclave_idx);
@@ -561,6 +774,8 @@ pisces_enclave_create(struct pisces_image * img)
 	struct proc_dir_entry * mem_entry = NULL;
 	struct proc_dir_entry * cpu_entry = NULL;
 	struct proc_dir_entry * pci_entry = NULL;
+	struct proc_dir_entry * io_entry  = NULL;
+	struct proc_dir_entry * boot_entry = NULL;
 
 	memset(name, 0, 128);
 	snprintf(name, 128, "enclave-%d", enclave->id);
@@ -585,10 +800,24 @@ pisces_enclave_create(struct pisces_image * img)
 	    pci_entry->proc_fops = &proc_pci_fops;
 	    pci_entry->data      = enclave;
 	}
+
+	io_entry = create_proc_entry("io",     0444, enclave->proc_dir);
+	if (io_entry) {
+	    io_entry->proc_fops  = &proc_io_fops;
+	    io_entry->data       = enclave;
+	}
+
+	boot_entry = create_proc_entry("boot_timeline", 0444, enclave->proc_dir);
+	if (boot_entry) {
+	    boot_entry->proc_fops = &proc_boot_timeline_fops;
+	    boot_entry->data      = enclave;
+	}
 #else
 	mem_entry = proc_create_data("memory",  0444, enclave->proc_dir, &proc_mem_fops, enclave);
 	cpu_entry = proc_create_data("cpus",    0444, enclave->proc_dir, &proc_cpu_fops, enclave);
 	pci_entry = proc_create_data("pci",     0444, enclave->proc_dir, &proc_pci_fops, enclave);
+	io_entry  = proc_create_data("io",      0444, enclave->proc_dir, &proc_io_fops,  enclave);
+	boot_entry = proc_create_data("boot_timeline", 0444, enclave->proc_dir, &proc_boot_timeline_fops, enclave);
 
 #endif
 
@@ -601,9 +830,64 @@ pisces_enclave_create(struct pisces_image * img)
 }
 
 
+/* 
+ * Adds the CPUs and memory beyond the boot CPU and boot memory through ctrl commands.
+ * Used when the enclave did not take them from the launch resource list
+ */
+static void
+ctrl_add_launch_res(struct pisces_enclave * enclave)
+{
+    /* Memory */
+    {
+	struct enclave_mem_block * iter    = NULL;
+	struct memory_range reg;
+
+	list_for_each_entry(iter, &(enclave->memdesc_list), node) 
+	{
+
+	    if ((iter->base_addr >= enclave->bootmem_addr_pa) && 
+		(iter->base_addr <  (enclave->bootmem_addr_pa + enclave->bootmem_size))) {
+		/* Don't add boot memory */
+		continue;
+	    } 
+
+	    memset(&reg, 0, sizeof(struct memory_range));
+	    
+	    reg.base_addr = iter->base_addr;
+	    reg.pages     = iter->pages;
+
+	    if (ctrl_add_mem(enclave, &reg) != 0) {
+		printk(KERN_ERR "Error: Could not add memory [%p] after launch\n",
+		       (void *)reg.base_addr);
+	    }
+	}
+	
+    }
+
+
+    /* CPUs */
+    {
+	u64 cpu_id = 0;
+
+	for_each_cpu(cpu_id, &(enclave->assigned_cpus)) {
+
+	    /* Don't add the boot CPU */
+	    if (cpu_id == enclave->boot_cpu) continue;
+
+	    if (ctrl_add_cpu(enclave, cpu_id) != 0) {
+		printk(KERN_ERR "Error: Could not add CPU [%llu] after launch\n",
+		       cpu_id);
+	    }
+	}
+	
+    }
+}
+
+
 static int 
 pisces_enclave_launch(struct pisces_enclave * enclave) 
 {
+    struct pisces_boot_params * boot_params = NULL;
 
     if (setup_boot_params(enclave) == -1) {
         printk(KERN_ERR "Error setting up boot environment\n");
@@ -617,6 +901,14 @@ pisces_enclave_launch(struct pisces_enclave * enclave)
     }
     enclave->state = ENCLAVE_RUNNING;
 
+    boot_params = __va(enclave->bootmem_addr_pa);
+
+    /* The enclave sets resources_added before initialized, so it is final by now */
+    if ((boot_params->launch_res_addr == 0) || 
+	(boot_params->resources_added == 0)) {
+	ctrl_add_launch_res(enclave);
+    }
+
     return 0;
 
 }
@@ -627,6 +919,12 @@ int
 pisces_enclave_free(struct pisces_enclave * enclave) 
 {
 
+    /* Goes first, user space mappings of console rings keep the whole enclave from being freed */
+    if (pisces_cons_deinit(enclave) != 0) {
+	printk(KERN_ERR "Cannot free enclave %d while its console rings are mapped\n", enclave->id);
+	return -EBUSY;
+    }
+
     enclave->state = ENCLAVE_DEAD;
 
     /* Free Enclave device file */
@@ -646,6 +944,8 @@ pisces_enclave_free(struct pisces_enclave * enclave)
 	remove_proc_entry("memory", enclave->proc_dir);
 	remove_proc_entry("cpus",   enclave->proc_dir);
 	remove_proc_entry("pci",    enclave->proc_dir);
+	remove_proc_entry("io",     enclave->proc_dir);
+	remove_proc_entry("boot_timeline", enclave->proc_dir);
 	remove_proc_entry(name,     pisces_proc_dir);
     }
 
@@ -660,6 +960,34 @@ pisces_enclave_free(struct pisces_enclave * enclave)
     pisces_xpmem_deinit(enclave);
 #endif
 
+    pisces_free_enclave_pgts(enclave);
+
+    /* Scrub enclave memory before it can be handed back to Linux */
+    if (scrub_on_free) {
+	struct enclave_mem_block * memdesc = NULL;
+	struct pisces_scrub      * scrubs  = NULL;
+	int i = 0;
+
+	scrubs = kcalloc(enclave->memdesc_num, sizeof(struct pisces_scrub), GFP_KERNEL);
+
+	/* Scrub every block concurrently, or one at a time if we're short on memory */
+	list_for_each_entry(memdesc, &(enclave->memdesc_list), node) {
+	    u64 size = (u64)memdesc->pages * PAGE_SIZE;
+
+	    if (!scrubs) {
+		pisces_scrub_range(memdesc->base_addr, size);
+	    } else if (pisces_scrub_start(&(scrubs[i]), memdesc->base_addr, size) == 0) {
+		i++;
+	    }
+	}
+
+	while (i > 0) {
+	    pisces_scrub_wait(&(scrubs[--i]));
+	}
+
+	kfree(scrubs);
+    }
+
     /* Remove Memory descriptors */
     {
 	struct enclave_mem_block * memdesc = NULL;
@@ -707,22 +1035,106 @@ enclave_put(struct pisces_enclave * enclave)
 
 
 
+/* Returns the enclave a CPU is assigned to, called with enclave_map_lock held */
+static struct pisces_enclave *
+cpu_owner(u32 cpu_id)
+{
+    int i = 0;
+
+    for (i = 0; i < MAX_ENCLAVES; i++) {
+	if ((enclave_map[i]) && 
+	    (cpumask_test_cpu(cpu_id, &(enclave_map[i]->assigned_cpus)))) {
+	    return enclave_map[i];
+	}
+    }
+
+    return NULL;
+}
+
 int 
 pisces_enclave_add_cpu(struct pisces_enclave * enclave, 
 		       u32                     cpu_id) 
 {
+    struct pisces_enclave * owner = NULL;
+
+    mutex_lock(&enclave_map_lock);
+    {
+	owner = cpu_owner(cpu_id);
 
-    if (cpumask_test_and_set_cpu(cpu_id, &(enclave->assigned_cpus))) {
-	// CPU already present
-	printk(KERN_ERR "Error tried to add an already present CPU (%d) to enclave %d\n", cpu_id, enclave->id);
+	if (owner == NULL) {
+	    cpumask_set_cpu(cpu_id, &(enclave->assigned_cpus));
+	    enclave->num_cpus++;
+	}
+    }
+    mutex_unlock(&enclave_map_lock);
+
+    if (owner) {
+	printk(KERN_ERR "Error tried to add CPU %d to enclave %d, but it belongs to enclave %d\n", 
+	       cpu_id, enclave->id, owner->id);
 	return -1;
     }
 
-    enclave->num_cpus++;
+    return 0;
+}
+
+static void
+pisces_enclave_remove_cpu(struct pisces_enclave * enclave, 
+			  u32                     cpu_id)
+{
+    mutex_lock(&enclave_map_lock);
+    {
+	if (cpumask_test_and_clear_cpu(cpu_id, &(enclave->assigned_cpus))) {
+	    enclave->num_cpus--;
+	}
+    }
+    mutex_unlock(&enclave_map_lock);
+}
+
+
+/* Called with enclave_map_lock held */
+static int
+mem_in_use(u64 base_addr, 
+	   u64 size)
+{
+    int i = 0;
+
+    for (i = 0; i < MAX_ENCLAVES; i++) {
+	struct pisces_enclave    * enclave = enclave_map[i];
+	struct enclave_mem_block * iter    = NULL;
+
+	if (enclave == NULL) {
+	    continue;
+	}
+
+	list_for_each_entry(iter, &(enclave->memdesc_list), node) {
+	    u64 blk_end = iter->base_addr + ((u64)iter->pages * PAGE_SIZE);
+
+	    if ((base_addr < blk_end) && (iter->base_addr < (base_addr + size))) {
+		return 1;
+	    }
+	}
+    }
 
     return 0;
 }
 
+int
+pisces_enclave_mem_in_use(u64 base_addr, 
+			  u64 size)
+{
+    int in_use = 0;
+
+    /* A freed enclave leaves the map before its memory list is torn down */
+    mutex_lock(&enclave_map_lock);
+    {
+	in_use = mem_in_use(base_addr, size);
+    }
+    mutex_unlock(&enclave_map_lock);
+
+    return in_use;
+}
+
+
 int 
 pisces_enclave_add_mem(struct pisces_enclave * enclave, 
 		       u64                     base_addr, 
@@ -731,7 +1143,7 @@ pisces_enclave_add_mem(struct pisces_enclave * enclave,
     struct enclave_mem_block * memdesc = kmalloc(sizeof(struct enclave_mem_block), GFP_KERNEL);
     struct enclave_mem_block * iter    = NULL;
 
-    if (IS_ERR(memdesc)) {
+    if (memdesc == NULL) {
 	printk(KERN_ERR "Could not allocate memory descriptor\n");
 	return -1;
     }
@@ -739,23 +1151,57 @@ pisces_enclave_add_mem(struct pisces_enclave * enclave,
     memdesc->base_addr = base_addr;
     memdesc->pages     = pages;
 
-    if (enclave->memdesc_num == 0) {
-	list_add(&(memdesc->node), &(enclave->memdesc_list));
-    } else {
+    mutex_lock(&enclave_map_lock);
+    {
+	if (mem_in_use(base_addr, (u64)pages * PAGE_SIZE)) {
+	    mutex_unlock(&enclave_map_lock);
 
-	list_for_each_entry(iter, &(enclave->memdesc_list), node) {
-	    if (iter->base_addr > memdesc->base_addr) {
-		list_add_tail(&(memdesc->node), &(iter->node));
-		break;
-	    } else if (list_is_last(&(iter->node), &(enclave->memdesc_list))) {
-		list_add(&(memdesc->node), &(iter->node));
-		break;
+	    printk(KERN_ERR "Error tried to add memory [%p, %u pages] to enclave %d, but it is already assigned\n", 
+		   (void *)base_addr, pages, enclave->id);
+	    kfree(memdesc);
+	    return -1;
+	}
+
+	if (enclave->memdesc_num == 0) {
+	    list_add(&(memdesc->node), &(enclave->memdesc_list));
+	} else {
+
+	    list_for_each_entry(iter, &(enclave->memdesc_list), node) {
+		if (iter->base_addr > memdesc->base_addr) {
+		    list_add_tail(&(memdesc->node), &(iter->node));
+		    break;
+		} else if (list_is_last(&(iter->node), &(enclave->memdesc_list))) {
+		    list_add(&(memdesc->node), &(iter->node));
+		    break;
+		}
 	    }
 	}
-    }
 
-    enclave->memdesc_num++;
+	enclave->memdesc_num++;
+    }
+    mutex_unlock(&enclave_map_lock);
 
     return 0;
 }
 
+static void
+pisces_enclave_remove_mem(struct pisces_enclave * enclave, 
+			  u64                     base_addr)
+{
+    struct enclave_mem_block * iter = NULL;
+
+    mutex_lock(&enclave_map_lock);
+    {
+	list_for_each_entry(iter, &(enclave->memdesc_list), node) {
+	    if (iter->base_addr == base_addr) {
+		list_del(&(iter->node));
+		kfree(iter);
+
+		enclave->memdesc_num--;
+		break;
+	    }
+	}
+    }
+    mutex_unlock(&enclave_map_lock);
+}
+
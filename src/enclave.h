@@ -23,6 +23,8 @@
 #define ENCLAVE_RUNNING     2
 #define ENCLAVE_DEAD        3
 
+struct enclave_pgts;
+
 struct enclave_mem_block {
     u64 base_addr;
     u32 pages;
@@ -59,6 +61,10 @@ struct pisces_enclave {
     uintptr_t bootmem_addr_pa;
     u64       bootmem_size;
 
+    u64       console_ring_size;
+
+    struct enclave_pgts * boot_pgts;
+
     struct kref  refcount;
     struct mutex op_lock;
 
@@ -95,6 +101,11 @@ int
 pisces_enclave_add_cpu(struct pisces_enclave * enclave, 
 		       u32                     cpu_id);
 
+/* Returns 1 if any part of the range is assigned to an enclave */
+int
+pisces_enclave_mem_in_use(u64 base_addr, 
+			  u64 size);
+
 
 
 
@@ -4,14 +4,321 @@
  */
 
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/fs.h>    /* device file */
 #include <linux/anon_inodes.h>
+#include <linux/poll.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/version.h>
+#include <linux/log2.h>
+#include <linux/rcupdate.h>
 #include <asm/uaccess.h>
 
 #include "enclave.h"
 #include "enclave_cons.h"
+#include "pisces_irq.h"
+#include "pisces_ioctl.h"
 
 
+static int console_records = 0;
+module_param(console_records, int, 0644);
+MODULE_PARM_DESC(console_records, "Have enclaves launched from now on write timestamped console records");
+
+
+/* Ring poll interval for enclaves that do not send doorbell IPIs */
+#define CONS_POLL_INTERVAL (HZ / 10)
+
+/* A reader further behind than this stops holding tail back */
+#define CONS_MAX_READER_LAG(cons) ((cons)->size / 2)
+
+
+struct cons_reader {
+    struct pisces_enclave * enclave;
+    u64                     pos;
+    int                     overrun;   /* Skipped ahead, the next read reports it */
+    struct list_head        node;
+};
+
+
+/* head and tail live in memory shared with the enclave */
+static inline u64
+cons_ring_head(struct pisces_cons_ringbuf * ringbuf)
+{
+    return *(volatile u64 *)&(ringbuf->head);
+}
+
+static inline u64
+cons_ring_tail(struct pisces_cons_ringbuf * ringbuf)
+{
+    return *(volatile u64 *)&(ringbuf->tail);
+}
+
+static inline void
+cons_ring_set_tail(struct pisces_cons_ringbuf * ringbuf, 
+		   u64                          tail)
+{
+    *(volatile u64 *)&(ringbuf->tail) = tail;
+}
+
+/* A reader consuming in place through mmap is wherever it has set tail */
+static inline u64
+cons_reader_pos(struct cons_reader * reader)
+{
+    struct pisces_cons * cons = &(reader->enclave->cons);
+
+    if (atomic_read(&(cons->tail_mmap_count)) > 0) {
+	return cons_ring_tail(cons->cons_ringbuf);
+    }
+
+    return reader->pos;
+}
+
+/* Lockless peek for wait conditions and poll
+ *   Once dead is set the ring may be scrubbed or handed back to Linux, pisces_cons_deinit()
+ *   waits out these RCU read sections before it returns
+ */
+static inline int
+cons_reader_ready(struct cons_reader * reader)
+{
+    struct pisces_cons * cons = &(reader->enclave->cons);
+    int ready = 1;
+
+    if (reader->overrun) {
+	return 1;
+    }
+
+    rcu_read_lock();
+    {
+	if (!cons->dead) {
+	    ready = (cons_ring_head(cons->cons_ringbuf) != cons_reader_pos(reader));
+	}
+    }
+    rcu_read_unlock();
+
+    return ready;
+}
+
+
+/* Pull a reader back inside [tail, head] after a relaunch or an mmap consumer moved tail
+ *   Called with read_lock held
+ */
+static void
+cons_reader_sync(struct cons_reader * reader)
+{
+    struct pisces_cons_ringbuf * ringbuf = reader->enclave->cons.cons_ringbuf;
+    u64 head = 0;
+    u64 tail = 0;
+
+    if (reader->enclave->cons.dead) {
+	return;
+    }
+
+    head = cons_ring_head(ringbuf);
+    tail = cons_ring_tail(ringbuf);
+
+    if (((s64)(reader->pos - tail) < 0) ||
+	((s64)(head - reader->pos) < 0)) {
+	reader->pos = tail;
+    }
+}
+
+
+/* Hand the space every reader is done with back to the producer
+ *   A reader that has fallen too far behind is skipped to head so an idle fd can't stall the
+ *   console for everyone else. head is always a record boundary. The reader doing the update
+ *   (if any) is mid read and is left alone.
+ *   Called with read_lock held
+ */
+static void
+cons_update_tail(struct pisces_cons * cons,
+		 struct cons_reader * self)
+{
+    struct pisces_cons_ringbuf * ringbuf = cons->cons_ringbuf;
+    struct cons_reader         * reader  = NULL;
+    u64 head = cons_ring_head(ringbuf);
+    u64 tail = head;
+    int skipped = 0;
+
+    if ((cons->num_readers == 0) ||
+	(atomic_read(&(cons->tail_mmap_count)) > 0)) {
+	/* Nobody to advance it, or user space owns it */
+	return;
+    }
+
+    list_for_each_entry(reader, &(cons->readers), node) {
+	if ((reader != self) && (head - reader->pos > CONS_MAX_READER_LAG(cons))) {
+	    reader->pos     = head;
+	    reader->overrun = 1;
+	    skipped         = 1;
+	    continue;
+	}
+
+	if ((s64)(reader->pos - tail) < 0) {
+	    tail = reader->pos;
+	}
+    }
+
+    /* Finish reading the data before handing the space back to the producer */
+    smp_mb();
+
+    cons_ring_set_tail(ringbuf, tail);
+
+    if (skipped) {
+	/* Skipped readers may be asleep waiting for data */
+	wake_up_interruptible(&(cons->waitq));
+    }
+}
+
+
+/* The doorbell only rings when the enclave writes to an empty ring. With several readers a slow
+ *   one can keep the ring from ever looking empty to the enclave, so the others still need polling
+ */
+static inline int
+cons_needs_poll(struct pisces_cons * cons)
+{
+    return ((cons->num_readers > 1) || 
+	    ((cons->num_readers == 1) && (!cons->doorbell_seen)));
+}
+
+
+static irqreturn_t
+cons_notify_handler(int    irq, 
+		    void * priv_data)
+{
+    struct pisces_cons * cons = priv_data;
+
+    /* This enclave rings the doorbell, the poll worker can stop */
+    cons->doorbell_seen = 1;
+
+    wake_up_interruptible(&(cons->waitq));
+
+    return IRQ_HANDLED;
+}
+
+
+static void
+cons_poll_worker(struct work_struct * work)
+{
+    struct pisces_cons * cons = container_of(work, struct pisces_cons, poll_work.work);
+    u64 head = 0;
+
+    if (cons->dead) {
+	wake_up_interruptible(&(cons->waitq));
+	return;
+    }
+
+    head = cons_ring_head(cons->cons_ringbuf);
+
+    if (head != cons->poll_head) {
+	cons->poll_head = head;
+	wake_up_interruptible(&(cons->waitq));
+    }
+
+    if (cons_needs_poll(cons)) {
+	schedule_delayed_work(&(cons->poll_work), CONS_POLL_INTERVAL);
+    }
+}
+
+
+
+/* Copy out raw bytes from the reader's position */
+static ssize_t 
+cons_read_bytes(struct cons_reader * reader,
+		char __user        * buffer,
+		size_t               length,
+		u64                  head)
+{
+    struct pisces_cons         * cons    = &(reader->enclave->cons);
+    struct pisces_cons_ringbuf * ringbuf = cons->cons_ringbuf;
+    u64 idx      = reader->pos & cons->mask;
+    u64 read_len = 0;
+
+    if (length > head - reader->pos) {
+	length = head - reader->pos;
+    }
+
+    read_len = min_t(u64, length, cons->size - idx);
+
+    if ((copy_to_user(buffer, ringbuf->buf + idx, read_len)) ||
+	(copy_to_user(buffer + read_len, ringbuf->buf, length - read_len))) {
+	printk(KERN_ERR "Error copying console data to user space\n");
+	return -EFAULT;
+    }
+
+    reader->pos += length;
+
+    return length;
+}
+
+
+/* Copy out as many whole records as fit in the buffer */
+static ssize_t 
+cons_read_records(struct cons_reader * reader,
+		  char __user        * buffer,
+		  size_t               length,
+		  u64                  head)
+{
+    struct pisces_cons         * cons    = &(reader->enclave->cons);
+    struct pisces_cons_ringbuf * ringbuf = cons->cons_ringbuf;
+    size_t copied = 0;
+
+    while (reader->pos != head) {
+	struct pisces_cons_record * rec = NULL;
+	u64 idx       = reader->pos & cons->mask;
+	u64 contig    = cons->size - idx;
+	u64 rec_bytes = 0;
+
+	if (contig < sizeof(struct pisces_cons_record)) {
+	    goto corrupt;
+	}
+
+	rec = (struct pisces_cons_record *)(ringbuf->buf + idx);
+
+	if (rec->flags & PISCES_CONS_REC_PAD) {
+	    /* Padding runs to the end of the ring, never past what the producer published */
+	    if (contig > head - reader->pos) {
+		goto corrupt;
+	    }
+
+	    reader->pos += contig;
+	    continue;
+	}
+
+	rec_bytes = sizeof(struct pisces_cons_record) + rec->len;
+
+	if ((rec_bytes > contig) ||
+	    (ALIGN(rec_bytes, PISCES_CONS_REC_ALIGN) > head - reader->pos)) {
+	    goto corrupt;
+	}
+
+	if (copied + rec_bytes > length) {
+	    if (copied == 0) {
+		/* The buffer can't hold the next record */
+		return -EINVAL;
+	    }
+
+	    break;
+	}
+
+	if (copy_to_user(buffer + copied, rec, rec_bytes)) {
+	    printk(KERN_ERR "Error copying console record to user space\n");
+	    return -EFAULT;
+	}
+
+	copied      += rec_bytes;
+	reader->pos += ALIGN(rec_bytes, PISCES_CONS_REC_ALIGN);
+    }
+
+    return copied;
+
+ corrupt:
+    printk(KERN_ERR "Corrupt console record at %llu, skipping to %llu\n", reader->pos, head);
+    reader->pos = head;
+
+    return copied;
+}
 
 
 static ssize_t 
@@ -20,119 +327,451 @@ console_read(struct file  * file,
 	     size_t         length, 
 	     loff_t       * offset)
 {
-    struct pisces_enclave      * enclave = (struct pisces_enclave *)file->private_data;
-    struct pisces_cons_ringbuf * ringbuf = enclave->cons.cons_ringbuf;
-    size_t left_to_read = 0;
-    u64    read_len     = 0;
-    
-    pisces_spin_lock(&(ringbuf->lock));
-    {
-/*     printk("console len=%llu, read_idx=%llu, write_idx=%llu\n",  */
-/* 	   ringbuf->cur_len, ringbuf->read_idx, ringbuf->write_idx); */
-	
-	if (length > ringbuf->cur_len) {
-	    length = ringbuf->cur_len;
-	}
-	
-	left_to_read = length;
-	
-	if (left_to_read > 0) {
-	    if (ringbuf->read_idx >= ringbuf->write_idx) {
-		// first we need to read from read_idx to end of buf
-		
-		read_len = sizeof(ringbuf->buf) - ringbuf->read_idx;
-		
-		if (read_len > left_to_read) {
-		    read_len = left_to_read;
-		}
-		
-		if (copy_to_user(buffer, ringbuf->buf + ringbuf->read_idx, read_len)) {
-		    printk(KERN_ERR "Error copying console data to user space\n");
-
-		    pisces_spin_unlock(&(ringbuf->lock));
-
-		    return -EFAULT;
-		}
-		
-		*offset            += read_len;
-		ringbuf->read_idx  += read_len;
-		ringbuf->read_idx  %= sizeof(ringbuf->buf);
-		ringbuf->cur_len   -= read_len;
-		left_to_read       -= read_len;
+    struct cons_reader         * reader  = file->private_data;
+    struct pisces_cons         * cons    = &(reader->enclave->cons);
+    struct pisces_cons_ringbuf * ringbuf = cons->cons_ringbuf;
+    ssize_t ret = 0;
+    u64     head = 0;
+
+    if (length == 0) {
+	return 0;
+    }
+
+    /* Padding and corrupt records can leave nothing to return, so go back to waiting */
+    while (ret == 0) {
+
+	while (!cons_reader_ready(reader)) {
+	    if (file->f_flags & O_NONBLOCK) {
+		return -EAGAIN;
+	    }
+
+	    if (wait_event_interruptible(cons->waitq, cons_reader_ready(reader)) != 0) {
+		return -ERESTARTSYS;
 	    }
-	} 
-	
-	if (left_to_read > 0) {
-	    
-	    read_len = ringbuf->write_idx - ringbuf->read_idx;
-	    
-	    if (read_len > left_to_read) {
-		read_len = left_to_read;
+	}
+
+	mutex_lock(&(cons->read_lock));
+	{
+	    if (cons->dead) {
+		/* The ring is no longer ours to read */
+		mutex_unlock(&(cons->read_lock));
+		return 0;
 	    }
-	    
-	    // read from read_idx to write_idx
-	    if (copy_to_user(buffer, ringbuf->buf + ringbuf->read_idx, read_len)) {
-		printk(KERN_ERR "Error copying console data to user space\n");
-		
-		pisces_spin_unlock(&(ringbuf->lock));
-		
-		return -EFAULT;
+
+	    if (reader->overrun) {
+		/* Data was dropped from under this reader, tell it once */
+		reader->overrun = 0;
+		mutex_unlock(&(cons->read_lock));
+		return -EOVERFLOW;
 	    }
-	    
-	    *offset            += read_len;
-	    ringbuf->read_idx  += read_len;
-	    ringbuf->read_idx  %= sizeof(ringbuf->buf);
-	    ringbuf->cur_len   -= read_len;
-	    left_to_read       -= read_len;
-	    
-	}
-    }
-    pisces_spin_unlock(&(ringbuf->lock));
-    
-    /*    printk("Read %lu bytes\n", length); */
-    
-    return length;
+
+	    cons_reader_sync(reader);
+
+	    head = cons_ring_head(ringbuf);
+
+	    /* Don't read the data before we've seen the head that covers it */
+	    smp_rmb();
+
+	    if (head - reader->pos > cons->size) {
+		/* Producer state is corrupt, drop everything */
+		printk(KERN_ERR "Enclave console overrun (head=%llu, pos=%llu), resetting\n",
+		       head, reader->pos);
+		reader->pos = head;
+	    } else if (cons->flags & PISCES_CONS_FLAG_RECORDS) {
+		ret = cons_read_records(reader, buffer, length, head);
+	    } else {
+		ret = cons_read_bytes(reader, buffer, length, head);
+	    }
+
+	    cons_update_tail(cons, reader);
+	}
+	mutex_unlock(&(cons->read_lock));
+    }
+
+    if (ret > 0) {
+	*offset += ret;
+    }
+
+    return ret;
 }
 
 
 
+int 
+pisces_cons_check_size(u64 ring_size)
+{
+    if ((ring_size < PISCES_CONS_MIN_RING_SIZE) || 
+	(ring_size > PISCES_CONS_MAX_RING_SIZE) ||
+	(!is_power_of_2(ring_size))) {
+	return -1;
+    }
+
+    return 0;
+}
+
+
 int 
 pisces_cons_init(struct pisces_enclave      * enclave, 
-		 struct pisces_cons_ringbuf * ringbuf) 
+		 struct pisces_cons_ringbuf * ringbuf,
+		 u64                          ring_size) 
 {
     struct pisces_cons * cons = &enclave->cons;
 
+    /* User space collectors rely on this layout */
+    BUILD_BUG_ON(offsetof(struct pisces_cons_ringbuf, head) != PISCES_CONS_HEAD_OFFSET);
+    BUILD_BUG_ON(offsetof(struct pisces_cons_ringbuf, tail) != PISCES_CONS_TAIL_OFFSET);
+    BUILD_BUG_ON(offsetof(struct pisces_cons_ringbuf, buf)  != PISCES_CONS_DATA_OFFSET);
+    BUILD_BUG_ON(sizeof(struct pisces_cons_record) != PISCES_CONS_REC_ALIGN);
+
+    if (cons->initialized) {
+	/* On a relaunch readers may still be connected, they restart at the new tail */
+	mutex_lock(&(cons->read_lock));
+    }
+
+    /* The enclave can scribble on the header, so bounds come from these copies only */
     cons->cons_ringbuf = ringbuf;
-    cons->connected    = 0;
+    cons->size         = ring_size;
+    cons->mask         = ring_size - 1;
+    cons->flags        = (console_records) ? PISCES_CONS_FLAG_RECORDS : 0;
+
+    ringbuf->head    = 0;
+    ringbuf->tail    = 0;
+    ringbuf->size    = cons->size;
+    ringbuf->mask    = cons->mask;
+    ringbuf->flags   = cons->flags;
+    ringbuf->version = PISCES_CONS_VERSION;
+
+    /* Publish the layout before the magic */
+    smp_wmb();
+    ringbuf->magic   = PISCES_CONS_MAGIC;
+
+    if (cons->initialized) {
+	struct cons_reader * reader = NULL;
+
+	list_for_each_entry(reader, &(cons->readers), node) {
+	    reader->pos     = 0;
+	    reader->overrun = 0;
+	}
+
+	/* The new kernel may not ring the doorbell */
+	cons->poll_head     = 0;
+	cons->doorbell_seen = 0;
+
+	if (cons_needs_poll(cons)) {
+	    schedule_delayed_work(&(cons->poll_work), CONS_POLL_INTERVAL);
+	}
+
+	mutex_unlock(&(cons->read_lock));
+	return 0;
+    }
 
-    pisces_lock_init(&(ringbuf->lock));
-    spin_lock_init(&cons->lock);
+    cons->dead          = 0;
+    cons->closing       = 0;
+    cons->num_readers   = 0;
+    cons->poll_head     = 0;
+    cons->doorbell_seen = 0;
+    cons->notify_irq    = -1;
+    cons->notify_vector = 0;
+
+    atomic_set(&(cons->mmap_count),      0);
+    atomic_set(&(cons->tail_mmap_count), 0);
+    INIT_LIST_HEAD(&(cons->readers));
+    mutex_init(&(cons->read_lock));
+    init_waitqueue_head(&(cons->waitq));
+    INIT_DELAYED_WORK(&(cons->poll_work), cons_poll_worker);
+
+    cons->notify_irq = pisces_request_irq(cons_notify_handler, cons);
+
+    if (cons->notify_irq >= 0) {
+	cons->notify_vector = pisces_irq_to_vector(cons->notify_irq);
+
+	if (cons->notify_vector < 0) {
+	    pisces_release_irq(cons->notify_irq, cons);
+	    cons->notify_irq    = -1;
+	    cons->notify_vector = 0;
+	}
+    }
+
+    if (cons->notify_irq < 0) {
+	printk(KERN_WARNING "No console doorbell IRQ, falling back to polling\n");
+    }
+
+    cons->initialized = 1;
 
     return 0;
 }
 
 
+int
+pisces_cons_deinit(struct pisces_enclave * enclave)
+{
+    struct pisces_cons * cons = &enclave->cons;
+    int ret = 0;
+
+    if (!cons->initialized) {
+	return 0;
+    }
+
+    /* The ring lives in enclave memory, it can't go away while user space maps it */
+    mutex_lock(&(cons->read_lock));
+    {
+	if (atomic_read(&(cons->mmap_count)) > 0) {
+	    /* Mappers see POLLHUP and can unmap, then the free is retried */
+	    cons->closing = 1;
+	    ret = -EBUSY;
+	} else {
+	    /* Connected readers see EOF */
+	    cons->dead = 1;
+	}
+    }
+    mutex_unlock(&(cons->read_lock));
+
+    if (ret != 0) {
+	printk(KERN_ERR "Enclave %d memory is still mapped by user space\n", enclave->id);
+	wake_up_interruptible(&(cons->waitq));
+	return ret;
+    }
+
+    /* Let lockless peeks that missed dead finish with the ring */
+    synchronize_rcu();
+
+    wake_up_interruptible(&(cons->waitq));
+
+    cancel_delayed_work_sync(&(cons->poll_work));
+
+    if (cons->notify_irq >= 0) {
+	pisces_release_irq(cons->notify_irq, cons);
+	cons->notify_irq    = -1;
+	cons->notify_vector = 0;
+    }
+
+    return 0;
+}
+
+
+static unsigned int
+console_poll(struct file              * filp, 
+	     struct poll_table_struct * poll_tb)
+{
+    struct cons_reader * reader = filp->private_data;
+    struct pisces_cons * cons   = &(reader->enclave->cons);
+    unsigned int mask = 0;
+
+    poll_wait(filp, &(cons->waitq), poll_tb);
+
+    rcu_read_lock();
+    {
+	if (cons->dead) {
+	    mask = POLLHUP;
+	} else if (reader->overrun) {
+	    mask = POLLIN | POLLRDNORM | POLLERR;
+	} else if (cons_ring_head(cons->cons_ringbuf) != cons_reader_pos(reader)) {
+	    mask = POLLIN | POLLRDNORM;
+	}
+
+	if (cons->closing) {
+	    mask |= POLLHUP;
+	}
+    }
+    rcu_read_unlock();
+
+    return mask;
+}
+
+
 static int 
 console_release(struct inode * i, 
 		struct file  * filp) 
 {
-    struct pisces_enclave * enclave = filp->private_data;
+    struct cons_reader    * reader  = filp->private_data;
+    struct pisces_enclave * enclave = reader->enclave;
     struct pisces_cons    * cons    = &enclave->cons;
-    unsigned long flags;
-    
-    spin_lock_irqsave(&(cons->lock), flags);
+    int last = 0;
+
+    mutex_lock(&(cons->read_lock));
+    {
+	list_del(&(reader->node));
+	cons->num_readers--;
+	last = (cons->num_readers == 0);
+
+	/* The departing reader may have been holding tail back */
+	if (!cons->dead) {
+	    cons_update_tail(cons, NULL);
+	}
+    }
+    mutex_unlock(&(cons->read_lock));
+
+    if (last) {
+	cancel_delayed_work_sync(&(cons->poll_work));
+    }
+
+    kfree(reader);
+    enclave_put(enclave);
+
+    return 0;
+}
+
+
+/* Every user space mapping of enclave memory holds a reference, and is counted in mmap_count 
+ *   so the enclave can't be freed until the last one is gone
+ */
+void
+pisces_cons_mmap_get(struct pisces_enclave * enclave)
+{
+    enclave_get(enclave);
+    atomic_inc(&(enclave->cons.mmap_count));
+}
+
+void
+pisces_cons_mmap_put(struct pisces_enclave * enclave)
+{
+    atomic_dec(&(enclave->cons.mmap_count));
+    enclave_put(enclave);
+}
+
+/* For a new mapping, fails once the enclave is being freed */
+int
+pisces_cons_mmap_pin(struct pisces_enclave * enclave)
+{
+    struct pisces_cons * cons = &(enclave->cons);
+    int ret = 0;
+
+    if (!cons->initialized) {
+	return -ENODEV;
+    }
+
+    mutex_lock(&(cons->read_lock));
     {
-	cons->connected = 0;
+	if ((cons->dead) || (cons->closing)) {
+	    ret = -ENODEV;
+	} else {
+	    pisces_cons_mmap_get(enclave);
+	}
+    }
+    mutex_unlock(&(cons->read_lock));
+
+    return ret;
+}
+
+
+unsigned int
+pisces_cons_poll_hup(struct pisces_enclave    * enclave,
+		     struct file              * filp,
+		     struct poll_table_struct * poll_tb)
+{
+    struct pisces_cons * cons = &(enclave->cons);
+
+    if (!cons->initialized) {
+	return 0;
     }
-    spin_unlock_irqrestore(&(cons->lock), flags);
-    
+
+    poll_wait(filp, &(cons->waitq), poll_tb);
+
+    if ((cons->dead) || (cons->closing)) {
+	return POLLHUP;
+    }
+
     return 0;
 }
 
 
+static void
+console_vm_open(struct vm_area_struct * vma)
+{
+    struct pisces_cons * cons = vma->vm_private_data;
+
+    pisces_cons_mmap_get(container_of(cons, struct pisces_enclave, cons));
+
+    if (vma->vm_pgoff == (PISCES_CONS_TAIL_OFFSET >> PAGE_SHIFT)) {
+	atomic_inc(&(cons->tail_mmap_count));
+    }
+}
+
+static void
+console_vm_close(struct vm_area_struct * vma)
+{
+    struct pisces_cons * cons = vma->vm_private_data;
+
+    if (vma->vm_pgoff == (PISCES_CONS_TAIL_OFFSET >> PAGE_SHIFT)) {
+	atomic_dec(&(cons->tail_mmap_count));
+    }
+
+    pisces_cons_mmap_put(container_of(cons, struct pisces_enclave, cons));
+}
+
+static struct vm_operations_struct cons_vm_ops = {
+    .open  = console_vm_open,
+    .close = console_vm_close,
+};
+
+
+/* 
+ * Offset 0 maps the ring read-only, offset PISCES_CONS_TAIL_OFFSET maps the consumer page 
+ *   read-write so a collector can consume in place
+ */
+static int 
+console_mmap(struct file           * filp, 
+	     struct vm_area_struct * vma)
+{
+    struct cons_reader * reader = filp->private_data;
+    struct pisces_cons * cons   = &(reader->enclave->cons);
+    unsigned long ring_pfn = __pa(cons->cons_ringbuf) >> PAGE_SHIFT;
+    unsigned long size     = vma->vm_end - vma->vm_start;
+    unsigned long offset   = vma->vm_pgoff << PAGE_SHIFT;
+    int ret = 0;
+
+    if (!(vma->vm_flags & VM_SHARED)) {
+	return -EINVAL;
+    }
+
+    if (offset == 0) {
+	if (size > PAGE_ALIGN(pisces_cons_ring_bytes(cons->size))) {
+	    return -EINVAL;
+	}
+
+	if (vma->vm_flags & VM_WRITE) {
+	    return -EPERM;
+	}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6,3,0)
+	vma->vm_flags &= ~VM_MAYWRITE;
+#else
+	vm_flags_clear(vma, VM_MAYWRITE);
+#endif
+    } else if (offset != PISCES_CONS_TAIL_OFFSET) {
+	return -EINVAL;
+    } else if (size != PAGE_SIZE) {
+	return -EINVAL;
+    }
+
+    /* Consuming in place only works for a single reader */
+    mutex_lock(&(cons->read_lock));
+    {
+	if ((cons->dead) || (cons->closing)) {
+	    ret = -ENODEV;
+	} else if ((offset == PISCES_CONS_TAIL_OFFSET) && (cons->num_readers > 1)) {
+	    ret = -EBUSY;
+	} else if (remap_pfn_range(vma, vma->vm_start, ring_pfn + vma->vm_pgoff,
+				   size, vma->vm_page_prot) != 0) {
+	    ret = -EAGAIN;
+	} else {
+	    vma->vm_ops          = &cons_vm_ops;
+	    vma->vm_private_data = cons;
+
+	    console_vm_open(vma);
+	}
+    }
+    mutex_unlock(&(cons->read_lock));
+
+    return ret;
+}
+
+
 static struct file_operations cons_fops = {
     .owner    = THIS_MODULE,
     .read     = console_read,
+    .poll     = console_poll,
+    .mmap     = console_mmap,
     .release  = console_release
 };
 
@@ -141,11 +780,11 @@ static struct file_operations cons_fops = {
 int 
 pisces_cons_connect(struct pisces_enclave * enclave)
 {
-    struct pisces_cons * cons  = &enclave->cons;
-    unsigned long        flags = 0;
+    struct pisces_cons * cons   = &enclave->cons;
+    struct cons_reader * reader = NULL;
 
-    int cons_fd  = 0;
-    int acquired = 0;
+    int cons_fd = 0;
+    int ret     = 0;
 
     /*
     if (enclave->state != ENCLAVE_RUNNING) {
@@ -155,26 +794,70 @@ pisces_cons_connect(struct pisces_enclave * enclave)
 
     */
 
-    spin_lock_irqsave(&(cons->lock), flags);
+    if (!cons->initialized) {
+	printk(KERN_ERR "Enclave console has not been set up\n");
+	return -1;
+    }
+
+    reader = kmalloc(sizeof(struct cons_reader), GFP_KERNEL);
+
+    if (!reader) {
+	printk(KERN_ERR "Could not allocate console reader\n");
+	return -ENOMEM;
+    }
+
+    reader->enclave = enclave;
+    reader->overrun = 0;
+
+    mutex_lock(&(cons->read_lock));
     {
-	if (cons->connected == 0) {
-	    cons->connected = 1;
-	    acquired        = 1;
+	if (cons->dead) {
+	    ret = -1;
+	} else if (cons->num_readers >= PISCES_CONS_MAX_READERS) {
+	    printk(KERN_ERR "Too many console readers\n");
+	    ret = -1;
+	} else if (atomic_read(&(cons->tail_mmap_count)) > 0) {
+	    printk(KERN_ERR "Console is being consumed in place by another reader\n");
+	    ret = -1;
+	} else {
+	    /* New readers start with whatever is still buffered */
+	    reader->pos = cons_ring_tail(cons->cons_ringbuf);
+
+	    list_add_tail(&(reader->node), &(cons->readers));
+	    cons->num_readers++;
 	}
     }
-    spin_unlock_irqrestore(&(cons->lock), flags);
+    mutex_unlock(&(cons->read_lock));
 
-    if (acquired == 0) {
-        printk(KERN_ERR "Console already connected\n");
-        return -1;
+    if (ret != 0) {
+	kfree(reader);
+	return ret;
     }
 
-    cons_fd = anon_inode_getfd("enclave-cons", &cons_fops, enclave, O_RDWR);
+    /* The console file holds a reference so blocked readers survive an enclave free */
+    enclave_get(enclave);
+
+    cons_fd = anon_inode_getfd("enclave-cons", &cons_fops, reader, O_RDWR);
 
     if (cons_fd < 0) {
         printk(KERN_ERR "Error creating console inode\n");
+
+	mutex_lock(&(cons->read_lock));
+	{
+	    list_del(&(reader->node));
+	    cons->num_readers--;
+	}
+	mutex_unlock(&(cons->read_lock));
+
+	kfree(reader);
+	enclave_put(enclave);
+
         return cons_fd;
     }
 
+    if (cons_needs_poll(cons)) {
+	schedule_delayed_work(&(cons->poll_work), CONS_POLL_INTERVAL);
+    }
+
     return cons_fd;
 }
@@ -8,38 +8,133 @@
 
 #include <linux/types.h>
 #include <linux/fs.h>
-#include "pisces_lock.h"
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/mutex.h>
+#include <linux/list.h>
 
 struct pisces_enclave;
-
-// Embedded ringbuffer that maps into a 64KB chunk of memory
+struct poll_table_struct;
+
+#define PISCES_CONS_MAGIC     0x534e4f43   /* "CONS" */
+#define PISCES_CONS_VERSION   3
+#define PISCES_CONS_RING_SIZE (64 * 1024)      /* Default */
+
+/* Single producer (enclave) / single consumer (Linux) console ring.
+ *   head and tail are free running byte counters, the ring holds head - tail bytes
+ *   starting at buf[tail & mask]. Only the enclave writes head and only Linux writes tail,
+ *   each on its own page. The producer never moves tail, output that does not fit is dropped.
+ *   With PISCES_CONS_FLAG_RECORDS the data is a series of struct pisces_cons_record (pisces_ioctl.h).
+ *   Linux readers each keep their own position, tail follows the slowest of them. A reader more
+ *   than half a ring behind is skipped to head and its next read fails with -EOVERFLOW.
+ */
 struct pisces_cons_ringbuf {
-    struct pisces_spinlock lock;
-    u64 read_idx;
-    u64 write_idx;
-    u64 cur_len;
-    u8  buf[(64 * 1024) - 32];
+    /* Written once by Linux at setup */
+    u32 magic;
+    u32 version;
+    u64 size;        /* Power of two */
+    u64 mask;
+    u32 flags;       /* PISCES_CONS_FLAG_* */
+    u32 rsvd;
+    u8  rsvd0[32];
+
+    /* Producer page */
+    u64 head;
+    u8  rsvd1[4096 - 72];
+
+    /* Consumer page */
+    u64 tail;
+    u8  rsvd2[4096 - 8];
+
+    u8  buf[0];
 } __attribute__((packed));
 
 
 
 
+#define PISCES_CONS_MAX_READERS 8
+
 struct pisces_cons {
     struct pisces_cons_ringbuf * cons_ringbuf;
-    int connected;
-    spinlock_t  lock;
-} __attribute__((packed));
+    int dead;
+
+    /* A free is waiting for user space to unmap, pollers see POLLHUP but the ring is still live */
+    int closing;
+
+    /* Private copies of the ring header, it is shared with the enclave */
+    u64                 size;
+    u64                 mask;
+    u32                 flags;
+
+    /* Protects the reader list and serializes reads, the enclave never takes it */
+    struct mutex        read_lock;
+    struct list_head    readers;
+    int                 num_readers;
+
+    /* Readers sleep here until the ring has data */
+    wait_queue_head_t   waitq;
+
+    /* Doorbell IRQ the enclave raises when it writes to an empty ring (-1 if none) */
+    int                 notify_irq;
+    int                 notify_vector;
+
+    /* Fallback for enclaves that do not ring the doorbell, and for extra readers */
+    struct delayed_work poll_work;
+    u64                 poll_head;
+    int                 doorbell_seen;
+
+    /* Live user space mappings of enclave memory (this ring and VM console rings), 
+     *   and of just this ring's consumer page 
+     */
+    atomic_t            mmap_count;
+    atomic_t            tail_mmap_count;
+
+    int initialized;
+};
 
 
 
+/* Total bytes occupied by a ring holding ring_size bytes of data */
+#define pisces_cons_ring_bytes(ring_size) (sizeof(struct pisces_cons_ringbuf) + (ring_size))
+
+int 
+pisces_cons_check_size(u64 ring_size);
+
 int 
 pisces_cons_init(struct pisces_enclave      * enclave, 
-		 struct pisces_cons_ringbuf * ringbuf);
+		 struct pisces_cons_ringbuf * ringbuf,
+		 u64                          ring_size);
+
+/* Fails with -EBUSY while user space still maps the ring or any VM console ring,
+ *   the mappers are told to go away through POLLHUP
+ */
+int
+pisces_cons_deinit(struct pisces_enclave * enclave);
 
 int 
 pisces_cons_connect(struct pisces_enclave * enclave);
 
 
+/* Pin the enclave for a user space mapping of its memory
+ *   pin is for a new mapping and fails once the enclave is being freed,
+ *   get/put are for vm_open/vm_close
+ */
+int
+pisces_cons_mmap_pin(struct pisces_enclave * enclave);
+
+void
+pisces_cons_mmap_get(struct pisces_enclave * enclave);
+
+void
+pisces_cons_mmap_put(struct pisces_enclave * enclave);
+
+/* For other mapped rings' poll(), POLLHUP once the enclave is going away */
+unsigned int
+pisces_cons_poll_hup(struct pisces_enclave    * enclave,
+		     struct file              * filp,
+		     struct poll_table_struct * poll_tb);
+
+
 
 
 #endif
@@ -4,6 +4,9 @@
 #include <linux/anon_inodes.h>
 #include <linux/uaccess.h>
 #include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/ktime.h>
 
 
 #include "pisces_ioctl.h"
@@ -14,6 +17,8 @@
 #include "ctrl_ioctl.h"
 #include "pisces_xbuf.h"
 #include "enclave_pci.h"
+#include "file_io.h"
+#include "pisces_scrub.h"
 
 #include "pgtables.h"
 
@@ -108,6 +113,13 @@ ctrl_add_mem(struct pisces_enclave * enclave,
 
     cmd.phys_addr    = reg->base_addr;
     cmd.size         = reg->pages * PAGE_SIZE_4KB;
+
+    if (scrub_on_add) {
+	if (pisces_scrub_range(cmd.phys_addr, cmd.size) != 0) {
+	    printk(KERN_ERR "Error scrubbing memory for enclave %d\n", enclave->id);
+	    return -1;
+	}
+    }
     
     ret = pisces_xbuf_sync_send(xbuf_desc, (u8 *)&cmd, sizeof(struct cmd_mem_add),  (u8 **)&resp, &resp_len);
     
@@ -219,6 +231,270 @@ ctrl_add_pci(struct pisces_enclave  * enclave,
 }
 
 
+
+/* 
+ * Bulk file staging
+ *   The enclave hands us a list of physical buffers and we copy directly 
+ *   between them and the Linux file. The buffers are split into chunks
+ *   that are copied in parallel on the unbound workqueue.
+ */
+#define STAGE_CHUNK_SIZE (4 * 1024 * 1024)
+
+struct stage_xfer {
+    struct file       * file_ptr;
+    u32                 direction;
+    atomic_t            pending;
+    atomic64_t          bytes;
+    int                 error;
+    struct completion   done;
+};
+
+struct stage_work {
+    struct work_struct  work;
+    struct stage_xfer * xfer;
+    u64                 phys_addr;
+    u64                 size;
+    loff_t              offset;
+};
+
+
+static void
+stage_chunk(struct work_struct * work)
+{
+    struct stage_work * chunk = container_of(work, struct stage_work, work);
+    struct stage_xfer * xfer  = chunk->xfer;
+    u8                * buf   = __va(chunk->phys_addr);
+    u64                 done  = 0;
+
+    while (done < chunk->size) {
+	ssize_t ret = 0;
+
+	if (xfer->direction == PISCES_STAGE_LOAD) {
+	    ret = file_read(xfer->file_ptr, buf + done, chunk->size - done, chunk->offset + done);
+	} else {
+	    ret = file_write(xfer->file_ptr, buf + done, chunk->size - done, chunk->offset + done);
+	}
+
+	if (ret <= 0) {
+	    printk(KERN_ERR "Stage I/O error at offset %lld (ret=%ld)\n", 
+		   chunk->offset + done, (long)ret);
+	    xfer->error = -1;
+	    break;
+	}
+
+	done += ret;
+    }
+
+    atomic64_add(done, &(xfer->bytes));
+
+    if (atomic_dec_and_test(&(xfer->pending))) {
+	complete(&(xfer->done));
+    }
+}
+
+
+static int
+stage_copy(struct stage_xfer      * xfer, 
+	   struct stage_file_resp * stage_resp)
+{
+    struct stage_work * chunks     = NULL;
+    u64                 remaining  = stage_resp->file_size;
+    loff_t              offset     = 0;
+    u32                 num_chunks = 0;
+    u32                 i          = 0;
+    u64                 j          = 0;
+
+    for (i = 0; (i < stage_resp->num_descs) && (remaining > 0); i++) {
+	u64 desc_size = min(stage_resp->descs[i].size, remaining);
+
+	num_chunks += DIV_ROUND_UP(desc_size, STAGE_CHUNK_SIZE);
+	remaining  -= desc_size;
+    }
+
+    if (remaining > 0) {
+	printk(KERN_ERR "Enclave stage buffers are too small (%llu bytes short)\n", remaining);
+	return -1;
+    }
+
+    if (num_chunks == 0) {
+	return 0;
+    }
+
+    remaining = stage_resp->file_size;
+
+    chunks = kcalloc(num_chunks, sizeof(struct stage_work), GFP_KERNEL);
+
+    if (!chunks) {
+	printk(KERN_ERR "Could not allocate stage work items\n");
+	return -1;
+    }
+
+    num_chunks = 0;
+
+    for (i = 0; (i < stage_resp->num_descs) && (remaining > 0); i++) {
+	struct pisces_stage_desc * desc = &(stage_resp->descs[i]);
+	u64 desc_size = min(desc->size, remaining);
+
+	for (j = 0; j < desc_size; j += STAGE_CHUNK_SIZE) {
+	    struct stage_work * chunk = &(chunks[num_chunks++]);
+
+	    INIT_WORK(&(chunk->work), stage_chunk);
+
+	    chunk->xfer      = xfer;
+	    chunk->phys_addr = desc->phys_addr + j;
+	    chunk->size      = min_t(u64, STAGE_CHUNK_SIZE, desc_size - j);
+	    chunk->offset    = offset + j;
+	}
+
+	offset    += desc_size;
+	remaining -= desc_size;
+    }
+
+    atomic_set(&(xfer->pending), num_chunks);
+    
+    for (i = 0; i < num_chunks; i++) {
+	queue_work(system_unbound_wq, &(chunks[i].work));
+    }
+
+    wait_for_completion(&(xfer->done));
+
+    kfree(chunks);
+
+    return xfer->error;
+}
+
+
+static int
+stage_file(struct pisces_enclave    * enclave, 
+	   struct pisces_stage_file * spec)
+{
+    struct pisces_xbuf_desc * xbuf_desc  = enclave->ctrl.xbuf_desc;
+    struct pisces_resp      * resp       = NULL;
+    struct stage_file_resp  * stage_resp = NULL;
+    struct cmd_stage_file      cmd;
+    struct cmd_stage_file_done done_cmd;
+    struct stage_xfer          xfer;
+
+    ktime_t start_time;
+    u32     resp_len = 0;
+    int     ret      = 0;
+
+    memset(&cmd,  0, sizeof(struct cmd_stage_file));
+    memset(&xfer, 0, sizeof(struct stage_xfer));
+
+    spec->file_pair.lnx_file[127] = '\0';
+    spec->file_pair.lwk_file[127] = '\0';
+
+    if (spec->direction == PISCES_STAGE_LOAD) {
+	xfer.file_ptr = file_open(spec->file_pair.lnx_file, O_RDONLY);
+    } else if (spec->direction == PISCES_STAGE_STORE) {
+	xfer.file_ptr = file_open(spec->file_pair.lnx_file, O_WRONLY | O_CREAT | O_TRUNC);
+    } else {
+	printk(KERN_ERR "Invalid stage direction (%u)\n", spec->direction);
+	return -1;
+    }
+
+    if (xfer.file_ptr == NULL) {
+	return -1;
+    }
+
+    xfer.direction = spec->direction;
+    atomic64_set(&(xfer.bytes), 0);
+    init_completion(&(xfer.done));
+
+    start_time = ktime_get();
+
+    cmd.hdr.cmd      = PISCES_CMD_STAGE_FILE;
+    cmd.hdr.data_len = ( sizeof(struct cmd_stage_file) - 
+			 sizeof(struct pisces_cmd));
+    cmd.direction    = spec->direction;
+
+    memcpy(&(cmd.file_pair), &(spec->file_pair), sizeof(struct pisces_file_pair));
+
+    if (spec->direction == PISCES_STAGE_LOAD) {
+	loff_t f_size = file_size(xfer.file_ptr);
+
+	if (f_size < 0) {
+	    printk(KERN_ERR "Could not get the size of %s\n", spec->file_pair.lnx_file);
+	    file_close(xfer.file_ptr);
+	    return -1;
+	}
+
+	cmd.file_size = f_size;
+    }
+
+    ret = pisces_xbuf_sync_send(xbuf_desc, (u8 *)&cmd, sizeof(struct cmd_stage_file), (u8 **)&resp, &resp_len);
+
+    if (ret != 0) {
+	printk(KERN_ERR "Error sending stage request for %s\n", spec->file_pair.lnx_file);
+	file_close(xfer.file_ptr);
+	return -1;
+    }
+
+    if ((resp == NULL) || (resp_len < sizeof(struct pisces_resp))) {
+	printk(KERN_ERR "No response to stage request for %s\n", spec->file_pair.lnx_file);
+	kfree(resp);
+	file_close(xfer.file_ptr);
+	return -1;
+    }
+
+    stage_resp = (struct stage_file_resp *)resp->data;
+
+    if (((s64)resp->status < 0) ||
+	(sizeof(struct pisces_resp) + resp->data_len > resp_len) ||
+	(resp->data_len < sizeof(struct stage_file_resp)) ||
+	(resp->data_len < sizeof(struct stage_file_resp) + 
+	 ((u64)stage_resp->num_descs * sizeof(struct pisces_stage_desc)))) {
+	printk(KERN_ERR "Enclave rejected stage request for %s (status=%lld)\n", 
+	       spec->file_pair.lwk_file, (s64)resp->status);
+	kfree(resp);
+	file_close(xfer.file_ptr);
+	return -1;
+    }
+
+    if (spec->direction == PISCES_STAGE_LOAD) {
+	/* Never trust the enclave to size the copy from a Linux file */
+	stage_resp->file_size = cmd.file_size;
+    }
+
+    ret = stage_copy(&xfer, stage_resp);
+
+    kfree(resp);
+    resp = NULL;
+
+    /* Let the enclave commit or release its buffers */
+    memset(&done_cmd, 0, sizeof(struct cmd_stage_file_done));
+
+    done_cmd.hdr.cmd      = PISCES_CMD_STAGE_FILE_DONE;
+    done_cmd.hdr.data_len = ( sizeof(struct cmd_stage_file_done) - 
+			      sizeof(struct pisces_cmd));
+    done_cmd.direction    = spec->direction;
+    done_cmd.bytes        = atomic64_read(&(xfer.bytes));
+    done_cmd.status       = ret;
+
+    memcpy(&(done_cmd.file_pair), &(spec->file_pair), sizeof(struct pisces_file_pair));
+
+    if (pisces_xbuf_sync_send(xbuf_desc, (u8 *)&done_cmd, sizeof(struct cmd_stage_file_done), (u8 **)&resp, &resp_len) == 0) {
+	if ((resp == NULL) || (resp_len < sizeof(struct pisces_resp)) || ((s64)resp->status < 0)) {
+	    ret = -1;
+	}
+	kfree(resp);
+    } else {
+	ret = -1;
+    }
+
+    file_close(xfer.file_ptr);
+
+    spec->bytes = done_cmd.bytes;
+    spec->usecs = ktime_to_us(ktime_sub(ktime_get(), start_time));
+
+    printk("Staged %llu bytes (%s) in %llu usecs\n", 
+	   spec->bytes, spec->file_pair.lnx_file, spec->usecs);
+
+    return ret;
+}
+
+
 // Allow high level control commands over ioctl
 static long 
 ctrl_ioctl(struct file   * filp, 
@@ -500,6 +776,29 @@ ctrl_ioctl(struct file   * filp,
 
 		break;
 	    }
+	    case PISCES_CMD_STAGE_FILE: {
+		struct pisces_stage_file spec;
+
+		if (copy_from_user(&spec, argp, sizeof(struct pisces_stage_file))) {
+		    printk(KERN_ERR "Could not copy stage spec from user space\n");
+		    ret = -EFAULT;
+		    break;
+		}
+
+		if (stage_file(enclave, &spec) != 0) {
+		    printk(KERN_ERR "Error staging file (%s)\n", spec.file_pair.lnx_file);
+		    ret = -1;
+		    break;
+		}
+
+		if (copy_to_user(argp, &spec, sizeof(struct pisces_stage_file))) {
+		    printk(KERN_ERR "Could not copy stage results to user space\n");
+		    ret = -EFAULT;
+		    break;
+		}
+
+		break;
+	    }
 	    case PISCES_CMD_CREATE_VM: {
 		struct cmd_create_vm cmd;
 
@@ -5,6 +5,11 @@
 #include "enclave_fs.h"
 
 #include <linux/slab.h>
+#include <linux/pagemap.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/seq_file.h>
 
 //#define DEBUG
 #ifdef DEBUG
@@ -23,12 +28,126 @@ static int file_eq_fn(uintptr_t key1, uintptr_t key2) {
     return (key1 == key2);
 }
 
+/* The open file table maps each file pointer to its list entry */
 struct file_list_iter {
     uintptr_t        file_ptr;
     struct list_head node;
+
+    u64 reads;
+    u64 writes;
+    u64 bytes_read;
+    u64 bytes_written;
+};
+
+static const char * vfs_stat_names[VFS_NUM_STATS] = {
+    "open", "read", "write", "close", "size"
+};
+
+
+static void
+vfs_account(struct enclave_fs * fs_state, 
+	    int                 op, 
+	    s64                 bytes, 
+	    ktime_t             start_time)
+{
+    struct vfs_io_stats * stats = NULL;
+    struct vfs_op_stats * op_stats = NULL;
+    u64 ns     = ktime_to_ns(ktime_sub(ktime_get(), start_time));
+    u32 bucket = (ns > 1) ? ilog2(ns) : 0;
+
+    if (bucket >= VFS_LAT_BUCKETS) {
+	bucket = VFS_LAT_BUCKETS - 1;
+    }
+
+    stats    = get_cpu_ptr(fs_state->io_stats);
+    op_stats = &(stats->op[op]);
+
+    op_stats->ops++;
+    op_stats->total_ns += ns;
+    op_stats->lat_hist[bucket]++;
+
+    if (bytes < 0) {
+	op_stats->errors++;
+    } else {
+	op_stats->bytes += bytes;
+    }
+
+    put_cpu_ptr(fs_state->io_stats);
+}
+
+struct file_map {
+    struct file      * file_ptr;
+    u64                offset;
+    u32                num_pages;
+    struct page     ** pages;
+    struct list_head   node;
 };
 
 
+static void
+free_file_map(struct file_map * map)
+{
+    u32 i = 0;
+
+    for (i = 0; i < map->num_pages; i++) {
+	put_page(map->pages[i]);
+    }
+
+    list_del(&(map->node));
+
+    kfree(map->pages);
+    kfree(map);
+}
+
+/* Unpin every range mapped from a file (or all files if file_ptr is NULL) */
+static void
+free_file_maps(struct enclave_fs * fs_state, 
+	       struct file       * file_ptr)
+{
+    struct file_map * map  = NULL;
+    struct file_map * next = NULL;
+
+    list_for_each_entry_safe(map, next, &(fs_state->file_map_list), node) {
+	if ((file_ptr == NULL) || (map->file_ptr == file_ptr)) {
+	    free_file_map(map);
+	}
+    }
+}
+
+
+static int
+register_open_file(struct enclave_fs * fs_state, 
+		   struct file       * file_ptr)
+{
+    struct file_list_iter * iter = NULL;
+
+    if (htable_search(fs_state->open_file_table, (uintptr_t)file_ptr)) {
+	return 0;
+    }
+
+    iter = kmalloc(sizeof(struct file_list_iter), GFP_KERNEL);
+
+    if (!iter) {
+	printk("OUT OF MEMORY\n");
+	return -1;
+    }
+
+    memset(iter, 0, sizeof(struct file_list_iter));
+    iter->file_ptr = (uintptr_t)file_ptr;
+
+    mutex_lock(&(fs_state->file_list_lock));
+    {
+	htable_insert(fs_state->open_file_table, (uintptr_t)file_ptr, (uintptr_t)iter);
+	list_add_tail(&(iter->node), &(fs_state->open_file_list));
+
+	fs_state->num_files++;
+    }
+    mutex_unlock(&(fs_state->file_list_lock));
+
+    return 0;
+}
+
+
 int 
 enclave_vfs_open_lcall(struct pisces_enclave   * enclave, 
 		       struct pisces_xbuf_desc * xbuf_desc, 
@@ -37,34 +156,32 @@ enclave_vfs_open_lcall(struct pisces_enclave   * enclave,
     struct enclave_fs        * fs_state = &(enclave->fs_state);
     struct file              * file_ptr = NULL;
     struct pisces_lcall_resp   vfs_resp;
+    ktime_t                    start    = ktime_get();
 
     debug("Opening file %s (xbuf_desc=%p)\n", lcall->path, xbuf_desc);
 
     file_ptr = file_open(lcall->path, lcall->mode);
 
-    if (IS_ERR(file_ptr)) {
+    if ((file_ptr == NULL) || IS_ERR(file_ptr)) {
+	vfs_account(fs_state, VFS_STAT_OPEN, -1, start);
+
 	vfs_resp.status   = 0;
 	vfs_resp.data_len = 0;
 	pisces_xbuf_complete(xbuf_desc, (u8 *)&vfs_resp, sizeof(struct pisces_lcall_resp));
 	return 0;
     }
 
-    if (!htable_search(fs_state->open_file_table, (uintptr_t)file_ptr)) {
-	htable_insert(fs_state->open_file_table, (uintptr_t)file_ptr, (uintptr_t)file_ptr);
-
-        /* Add to file list */
-	{
-	    struct file_list_iter * iter = kmalloc(sizeof(struct file_list_iter), GFP_KERNEL);
-	    if (!iter) {
-		printk("OUT OF MEMORY\n");
-	    } else {
-		iter->file_ptr = (uintptr_t)file_ptr;
-		list_add_tail(&(iter->node), &(fs_state->open_file_list));
-	    }
-	}
+    if (register_open_file(fs_state, file_ptr) != 0) {
+	file_close(file_ptr);
+	vfs_account(fs_state, VFS_STAT_OPEN, -1, start);
+
+	vfs_resp.status   = 0;
+	vfs_resp.data_len = 0;
+	pisces_xbuf_complete(xbuf_desc, (u8 *)&vfs_resp, sizeof(struct pisces_lcall_resp));
+	return 0;
     }
 
-    fs_state->num_files++;
+    vfs_account(fs_state, VFS_STAT_OPEN, 0, start);
 
     vfs_resp.status   = (u64)file_ptr;
     vfs_resp.data_len = 0;
@@ -83,7 +200,9 @@ enclave_vfs_close_lcall(struct pisces_enclave   * enclave,
 {
     struct enclave_fs        * fs_state = &(enclave->fs_state);
     struct file              * file_ptr = NULL;
+    struct file_list_iter    * iter     = NULL;
     struct pisces_lcall_resp   vfs_resp;
+    ktime_t                    start    = ktime_get();
 
     file_ptr = (struct file *)lcall->file_handle;
 
@@ -94,6 +213,8 @@ enclave_vfs_close_lcall(struct pisces_enclave   * enclave,
     if (!htable_search(fs_state->open_file_table, (uintptr_t)file_ptr)) {
 	printk("File %p does not exist\n", file_ptr);
 
+	vfs_account(fs_state, VFS_STAT_CLOSE, -1, start);
+
 	// File does not exist
 	vfs_resp.status   = -1;
 	vfs_resp.data_len =  0;
@@ -103,28 +224,24 @@ enclave_vfs_close_lcall(struct pisces_enclave   * enclave,
 	return 0;
     }
 
-    htable_remove(fs_state->open_file_table, (uintptr_t)file_ptr, 0);
-
-    /* Remove from file list */
+    /* Remove from file table and list */
+    mutex_lock(&(fs_state->file_list_lock));
     {
-	struct file_list_iter * iter = NULL;
-	struct file_list_iter * next = NULL;
-
-	list_for_each_entry_safe(iter, next, &(fs_state->open_file_list), node) {
-	    if ((uintptr_t)file_ptr == iter->file_ptr) {
+	iter = (struct file_list_iter *)htable_remove(fs_state->open_file_table, (uintptr_t)file_ptr, 0);
 
-		list_del(&(iter->node));
-		kfree(iter);
+	list_del(&(iter->node));
+	kfree(iter);
 
-		break;
-	    }
-	}
+	fs_state->num_files--;
     }
+    mutex_unlock(&(fs_state->file_list_lock));
 
-    fs_state->num_files--;
+    free_file_maps(fs_state, file_ptr);
 
     file_close(file_ptr);
 
+    vfs_account(fs_state, VFS_STAT_CLOSE, 0, start);
+
     vfs_resp.status   = 0;
     vfs_resp.data_len = 0;
 
@@ -143,6 +260,7 @@ enclave_vfs_size_lcall(struct pisces_enclave   * enclave,
     struct enclave_fs        * fs_state = &(enclave->fs_state);
     struct file              * file_ptr = NULL;
     struct pisces_lcall_resp   vfs_resp;
+    ktime_t                    start    = ktime_get();
 
     file_ptr = (struct file *)lcall->file_handle;
     
@@ -151,6 +269,8 @@ enclave_vfs_size_lcall(struct pisces_enclave   * enclave,
     if (!htable_search(fs_state->open_file_table, (uintptr_t)file_ptr)) {
 	printk("File %p does not exist\n", file_ptr);
 
+	vfs_account(fs_state, VFS_STAT_SIZE, -1, start);
+
 	// File does not exist
 	vfs_resp.status   = -1;
 	vfs_resp.data_len =  0;
@@ -162,6 +282,8 @@ enclave_vfs_size_lcall(struct pisces_enclave   * enclave,
     vfs_resp.status   = file_size(file_ptr);
     vfs_resp.data_len = 0;
 
+    vfs_account(fs_state, VFS_STAT_SIZE, ((s64)vfs_resp.status < 0) ? -1 : 0, start);
+
     pisces_xbuf_complete(xbuf_desc, (u8 *)&vfs_resp, sizeof(struct pisces_lcall_resp));
     return 0;
 
@@ -169,6 +291,422 @@ enclave_vfs_size_lcall(struct pisces_enclave   * enclave,
 
 
 
+int 
+enclave_vfs_mkdir_lcall(struct pisces_enclave   * enclave, 
+			struct pisces_xbuf_desc * xbuf_desc, 
+			struct vfs_mkdir_lcall  * lcall)
+{
+    struct pisces_lcall_resp vfs_resp;
+    u32 path_len = 0;
+
+    path_len = lcall->lcall.data_len - (sizeof(struct vfs_mkdir_lcall) - sizeof(struct pisces_lcall));
+
+    if ((lcall->lcall.data_len <= (sizeof(struct vfs_mkdir_lcall) - sizeof(struct pisces_lcall))) ||
+	(lcall->path[path_len - 1] != '\0')) {
+	printk(KERN_ERR "Invalid mkdir request\n");
+
+	vfs_resp.status   = -1;
+	vfs_resp.data_len =  0;
+
+	pisces_xbuf_complete(xbuf_desc, (u8 *)&vfs_resp, sizeof(struct pisces_lcall_resp));
+	return 0;
+    }
+
+    debug("Creating directory %s\n", lcall->path);
+
+    vfs_resp.status   = file_mkdir(lcall->path, lcall->perms, lcall->recurse);
+    vfs_resp.data_len = 0;
+
+    pisces_xbuf_complete(xbuf_desc, (u8 *)&vfs_resp, sizeof(struct pisces_lcall_resp));
+
+    return 0;
+}
+
+
+
+struct readdir_state {
+    struct vfs_readdir_lcall * lcall;
+    u32 cur_desc;
+    u32 desc_offset;
+    u32 num_entries;
+    int no_space;     /* An entry was left for the next call */
+};
+
+static int
+readdir_fill(void         * priv, 
+	     const char   * name, 
+	     int            name_len, 
+	     u64            ino, 
+	     unsigned int   type)
+{
+    struct readdir_state * state   = priv;
+    struct vfs_dirent    * dirent  = NULL;
+    u32                    rec_len = 0;
+
+    rec_len = ALIGN(sizeof(struct vfs_dirent) + name_len + 1, 8);
+
+    /* Skip to the next buffer if this record doesn't fit in the current one */
+    while (state->cur_desc < state->lcall->num_descs) {
+	struct vfs_buf_desc * desc = &(state->lcall->descs[state->cur_desc]);
+
+	if (desc->size - state->desc_offset >= rec_len) {
+	    break;
+	}
+
+	state->cur_desc++;
+	state->desc_offset = 0;
+    }
+
+    if (state->cur_desc == state->lcall->num_descs) {
+	/* Out of space, stop here so the entry is returned by the next call */
+	state->no_space = 1;
+	return -ENOSPC;
+    }
+
+    dirent = __va(state->lcall->descs[state->cur_desc].phys_addr + state->desc_offset);
+
+    dirent->ino      = ino;
+    dirent->type     = type;
+    dirent->rec_len  = rec_len;
+    dirent->name_len = name_len;
+
+    memcpy(dirent->name, name, name_len);
+    dirent->name[name_len] = '\0';
+
+    state->desc_offset += rec_len;
+    state->num_entries++;
+
+    return 0;
+}
+
+
+int 
+enclave_vfs_readdir_lcall(struct pisces_enclave    * enclave, 
+			  struct pisces_xbuf_desc  * xbuf_desc, 
+			  struct vfs_readdir_lcall * lcall)
+{
+    struct enclave_fs        * fs_state = &(enclave->fs_state);
+    struct file              * file_ptr = NULL;
+    struct readdir_state       state;
+    struct {
+	struct pisces_lcall_resp hdr;
+	u64                      next_offset;
+    } __attribute__((packed)) vfs_resp;
+
+    loff_t offset = lcall->offset;
+
+    file_ptr = (struct file *)lcall->file_handle;
+
+    debug("Reading directory %p at offset %llu\n", file_ptr, lcall->offset);
+
+    if (!htable_search(fs_state->open_file_table, (uintptr_t)file_ptr)) {
+	printk("File %p does not exist\n", file_ptr);
+
+	vfs_resp.hdr.status   = -1;
+	vfs_resp.hdr.data_len =  0;
+
+	pisces_xbuf_complete(xbuf_desc, (u8 *)&vfs_resp, sizeof(struct pisces_lcall_resp));
+	return 0;
+    }
+
+    memset(&state, 0, sizeof(struct readdir_state));
+    state.lcall = lcall;
+
+    if ((file_readdir(file_ptr, &offset, readdir_fill, &state) < 0) && 
+	(state.num_entries == 0)) {
+	vfs_resp.hdr.status   = -1;
+	vfs_resp.hdr.data_len =  0;
+
+	pisces_xbuf_complete(xbuf_desc, (u8 *)&vfs_resp, sizeof(struct pisces_lcall_resp));
+	return 0;
+    }
+
+    if ((state.num_entries == 0) && (state.no_space)) {
+	/* Entries remain, but the first one is larger than every buffer */
+	printk(KERN_ERR "Directory entry does not fit in the enclave's readdir buffers\n");
+
+	vfs_resp.hdr.status   = -ENOSPC;
+	vfs_resp.hdr.data_len =  0;
+
+	pisces_xbuf_complete(xbuf_desc, (u8 *)&vfs_resp, sizeof(struct pisces_lcall_resp));
+	return 0;
+    }
+
+    vfs_resp.hdr.status   = state.num_entries;
+    vfs_resp.hdr.data_len = sizeof(u64);
+    vfs_resp.next_offset  = offset;
+
+    pisces_xbuf_complete(xbuf_desc, (u8 *)&vfs_resp, sizeof(vfs_resp));
+
+    return 0;
+}
+
+
+
+int 
+enclave_vfs_map_lcall(struct pisces_enclave   * enclave, 
+		      struct pisces_xbuf_desc * xbuf_desc, 
+		      struct vfs_map_lcall    * lcall)
+{
+    struct enclave_fs        * fs_state = &(enclave->fs_state);
+    struct file              * file_ptr = NULL;
+    struct file_map          * map      = NULL;
+    struct pisces_lcall_resp * vfs_resp = NULL;
+    struct pisces_lcall_resp   err_resp;
+    u64                      * pa_arr   = NULL;
+
+    loff_t f_size    = 0;
+    u64    length    = lcall->length;
+    u32    num_pages = 0;
+    u32    resp_len  = 0;
+    u32    i         = 0;
+
+    file_ptr = (struct file *)lcall->file_handle;
+
+    debug("Mapping file %p (offset=%llu, length=%llu)\n", file_ptr, lcall->offset, lcall->length);
+
+    if (!htable_search(fs_state->open_file_table, (uintptr_t)file_ptr)) {
+	printk("File %p does not exist\n", file_ptr);
+	goto err;
+    }
+
+    f_size = file_size(file_ptr);
+
+    if ((lcall->offset & ~PAGE_MASK) || 
+	(f_size < 0)                 || 
+	(lcall->offset >= f_size)) {
+	printk(KERN_ERR "Invalid file map range (offset=%llu, file size=%lld)\n", lcall->offset, f_size);
+	goto err;
+    }
+
+    if (length > (f_size - lcall->offset)) {
+	length = f_size - lcall->offset;
+    }
+
+    num_pages = (length + PAGE_SIZE - 1) >> PAGE_SHIFT;
+
+    if ((num_pages == 0) || (num_pages > VFS_MAP_MAX_PAGES)) {
+	printk(KERN_ERR "Invalid file map size (%u pages)\n", num_pages);
+	goto err;
+    }
+
+    map      = kmalloc(sizeof(struct file_map), GFP_KERNEL);
+    resp_len = sizeof(struct pisces_lcall_resp) + (num_pages * sizeof(u64));
+    vfs_resp = kmalloc(resp_len, GFP_KERNEL);
+
+    if ((!map) || (!vfs_resp)) {
+	printk(KERN_ERR "Could not allocate file map state\n");
+	goto err;
+    }
+
+    memset(map, 0, sizeof(struct file_map));
+
+    map->pages = kmalloc(num_pages * sizeof(struct page *), GFP_KERNEL);
+
+    if (!map->pages) {
+	printk(KERN_ERR "Could not allocate file map page list\n");
+	goto err;
+    }
+
+    map->file_ptr = file_ptr;
+    map->offset   = lcall->offset;
+    
+    list_add_tail(&(map->node), &(fs_state->file_map_list));
+
+    pa_arr = (u64 *)vfs_resp->data;
+
+    /* Pull each page into the page cache and hold a reference to it */
+    for (i = 0; i < num_pages; i++) {
+	pgoff_t       index = (lcall->offset >> PAGE_SHIFT) + i;
+	struct page * page  = NULL;
+
+	page = read_mapping_page(file_ptr->f_mapping, index, file_ptr);
+
+	if (IS_ERR(page)) {
+	    printk(KERN_ERR "Could not read page %lu of file %p\n", index, file_ptr);
+	    free_file_map(map);
+	    map = NULL;
+	    goto err;
+	}
+
+	map->pages[i] = page;
+	map->num_pages++;
+
+	pa_arr[i] = page_to_pfn(page) << PAGE_SHIFT;
+    }
+
+    vfs_resp->status   = (u64)map;
+    vfs_resp->data_len = num_pages * sizeof(u64);
+
+    pisces_xbuf_complete(xbuf_desc, (u8 *)vfs_resp, resp_len);
+
+    kfree(vfs_resp);
+
+    return 0;
+
+ err:
+    if (map) {
+	kfree(map->pages);
+	kfree(map);
+    }
+
+    kfree(vfs_resp);
+
+    err_resp.status   = 0;
+    err_resp.data_len = 0;
+
+    pisces_xbuf_complete(xbuf_desc, (u8 *)&err_resp, sizeof(struct pisces_lcall_resp));
+
+    return 0;
+}
+
+
+int 
+enclave_vfs_unmap_lcall(struct pisces_enclave   * enclave, 
+			struct pisces_xbuf_desc * xbuf_desc, 
+			struct vfs_unmap_lcall  * lcall)
+{
+    struct enclave_fs        * fs_state = &(enclave->fs_state);
+    struct file_map          * map      = NULL;
+    struct pisces_lcall_resp   vfs_resp;
+
+    vfs_resp.status   = -1;
+    vfs_resp.data_len =  0;
+
+    /* Only trust handles that we actually handed out */
+    list_for_each_entry(map, &(fs_state->file_map_list), node) {
+	if ((u64)map == lcall->map_handle) {
+	    free_file_map(map);
+	    vfs_resp.status = 0;
+	    break;
+	}
+    }
+
+    if (vfs_resp.status != 0) {
+	printk("File map %p does not exist\n", (void *)lcall->map_handle);
+    }
+
+    pisces_xbuf_complete(xbuf_desc, (u8 *)&vfs_resp, sizeof(struct pisces_lcall_resp));
+
+    return 0;
+}
+
+
+
+/* 
+ * Opens and/or stats every path in the request, returning one vfs_file_info per path.
+ *   The response status is the number of paths that were handled successfully
+ */
+int 
+enclave_vfs_open_batch_lcall(struct pisces_enclave       * enclave, 
+			     struct pisces_xbuf_desc     * xbuf_desc, 
+			     struct vfs_open_batch_lcall * lcall) 
+{
+    struct enclave_fs        * fs_state  = &(enclave->fs_state);
+    struct pisces_lcall_resp * vfs_resp  = NULL;
+    struct vfs_file_info     * info_arr  = NULL;
+    struct pisces_lcall_resp   err_resp;
+
+    u32 paths_len = 0;
+    u32 resp_len  = 0;
+    u32 offset    = 0;
+    u32 num_ok    = 0;
+    u32 i         = 0;
+
+    if ((lcall->lcall.data_len < (sizeof(struct vfs_open_batch_lcall) - sizeof(struct pisces_lcall))) ||
+	(lcall->num_paths > VFS_BATCH_MAX_PATHS)) {
+	printk(KERN_ERR "Invalid batched open request (%u paths)\n", lcall->num_paths);
+	goto err;
+    }
+
+    paths_len = lcall->lcall.data_len - (sizeof(struct vfs_open_batch_lcall) - sizeof(struct pisces_lcall));
+    resp_len  = sizeof(struct pisces_lcall_resp) + (lcall->num_paths * sizeof(struct vfs_file_info));
+    vfs_resp  = kmalloc(resp_len, GFP_KERNEL);
+
+    if (!vfs_resp) {
+	printk(KERN_ERR "Could not allocate batched open response\n");
+	goto err;
+    }
+
+    memset(vfs_resp, 0, resp_len);
+
+    info_arr = (struct vfs_file_info *)vfs_resp->data;
+
+    for (i = 0; i < lcall->num_paths; i++) {
+	info_arr[i].status = -1;
+    }
+
+    for (i = 0; i < lcall->num_paths; i++) {
+	struct vfs_path_desc * desc     = (struct vfs_path_desc *)(lcall->paths + offset);
+	struct vfs_file_info * info     = &(info_arr[i]);
+	struct file          * file_ptr = NULL;
+	loff_t                 size     = 0;
+	u64                    mtime    = 0;
+
+	/* Make sure the descriptor and its path fit inside the request */
+	if ((paths_len - offset < sizeof(struct vfs_path_desc)) ||
+	    (paths_len - offset - sizeof(struct vfs_path_desc) < desc->path_len) ||
+	    (desc->path_len == 0) || 
+	    (desc->path[desc->path_len - 1] != '\0')) {
+	    printk(KERN_ERR "Malformed path descriptor (%u) in batched open\n", i);
+	    break;
+	}
+
+	offset += sizeof(struct vfs_path_desc) + desc->path_len;
+
+	debug("Batched open of file %s\n", desc->path);
+
+	file_ptr = file_open(desc->path, (lcall->flags & VFS_BATCH_OPEN) ? desc->mode : O_RDONLY);
+
+	if ((file_ptr == NULL) || IS_ERR(file_ptr)) {
+	    continue;
+	}
+
+	if (lcall->flags & VFS_BATCH_STAT) {
+	    if (file_stat(file_ptr, &size, &mtime) != 0) {
+		file_close(file_ptr);
+		continue;
+	    }
+
+	    info->size  = size;
+	    info->mtime = mtime;
+	}
+
+	if (lcall->flags & VFS_BATCH_OPEN) {
+	    if (register_open_file(fs_state, file_ptr) != 0) {
+		file_close(file_ptr);
+		continue;
+	    }
+
+	    info->file_handle = (u64)file_ptr;
+	} else {
+	    file_close(file_ptr);
+	}
+
+	info->status = 0;
+	num_ok++;
+    }
+
+    vfs_resp->status   = num_ok;
+    vfs_resp->data_len = resp_len - sizeof(struct pisces_lcall_resp);
+
+    pisces_xbuf_complete(xbuf_desc, (u8 *)vfs_resp, resp_len);
+
+    kfree(vfs_resp);
+
+    return 0;
+
+ err:
+    err_resp.status   = -1;
+    err_resp.data_len =  0;
+
+    pisces_xbuf_complete(xbuf_desc, (u8 *)&err_resp, sizeof(struct pisces_lcall_resp));
+
+    return 0;
+}
+
+
+
 int 
 enclave_vfs_read_lcall(struct pisces_enclave   * enclave, 
 		       struct pisces_xbuf_desc * xbuf_desc, 
@@ -176,7 +714,9 @@ enclave_vfs_read_lcall(struct pisces_enclave   * enclave,
 {
     struct enclave_fs        * fs_state = &(enclave->fs_state);
     struct file              * file_ptr = NULL;
+    struct file_list_iter    * iter     = NULL;
     struct pisces_lcall_resp   vfs_resp;
+    ktime_t                    start    = ktime_get();
 
     u64 offset           = lcall->offset;
     u64 read_len         = lcall->length;
@@ -188,10 +728,14 @@ enclave_vfs_read_lcall(struct pisces_enclave   * enclave,
 
     debug("FS: Reading file %p\n", file_ptr);
     
-    if (!htable_search(fs_state->open_file_table, (uintptr_t)file_ptr)) {
+    iter = (struct file_list_iter *)htable_search(fs_state->open_file_table, (uintptr_t)file_ptr);
+
+    if (!iter) {
 	// File does not exist
 	printk("File %p does not exist\n", file_ptr);
 
+	vfs_account(fs_state, VFS_STAT_READ, -1, start);
+
 	vfs_resp.status   = -1;
 	vfs_resp.data_len =  0;
 
@@ -237,6 +781,11 @@ enclave_vfs_read_lcall(struct pisces_enclave   * enclave,
     }
 
     
+    iter->reads++;
+    iter->bytes_read += total_bytes_read;
+
+    vfs_account(fs_state, VFS_STAT_READ, total_bytes_read, start);
+
     vfs_resp.status   = total_bytes_read;
     vfs_resp.data_len = 0;
 
@@ -252,7 +801,9 @@ enclave_vfs_write_lcall(struct pisces_enclave   * enclave,
 {
     struct enclave_fs       * fs_state = &(enclave->fs_state);
     struct file             * file_ptr = NULL;
+    struct file_list_iter   * iter     = NULL;
     struct pisces_lcall_resp  vfs_resp;
+    ktime_t                   start    = ktime_get();
 
     u64 offset              = lcall->offset;
     u64 write_len           = lcall->length;
@@ -264,10 +815,14 @@ enclave_vfs_write_lcall(struct pisces_enclave   * enclave,
 
     debug("writing file %p\n", file_ptr);    
 
-    if (!htable_search(fs_state->open_file_table, (uintptr_t)file_ptr)) {
+    iter = (struct file_list_iter *)htable_search(fs_state->open_file_table, (uintptr_t)file_ptr);
+
+    if (!iter) {
 	// File does not exist
 	printk("File %p does not exist\n", file_ptr);
 
+	vfs_account(fs_state, VFS_STAT_WRITE, -1, start);
+
 	vfs_resp.status   = -1;
 	vfs_resp.data_len =  0;
 
@@ -309,6 +864,11 @@ enclave_vfs_write_lcall(struct pisces_enclave   * enclave,
     }
 
     
+    iter->writes++;
+    iter->bytes_written += total_bytes_written;
+
+    vfs_account(fs_state, VFS_STAT_WRITE, total_bytes_written, start);
+
     vfs_resp.status   = total_bytes_written;
     vfs_resp.data_len = 0;
 
@@ -332,7 +892,16 @@ init_enclave_fs(struct pisces_enclave * enclave)
 	return -1;
     }
 
+    fs_state->io_stats = alloc_percpu(struct vfs_io_stats);
+    if (!fs_state->io_stats) {
+	printk("Cannot allocate VFS I/O stats\n");
+	free_htable(fs_state->open_file_table, 0, 0);
+	return -1;
+    }
+
     INIT_LIST_HEAD(&(fs_state->open_file_list));
+    INIT_LIST_HEAD(&(fs_state->file_map_list));
+    mutex_init(&(fs_state->file_list_lock));
 
     return 0;
 }
@@ -343,6 +912,9 @@ deinit_enclave_fs(struct pisces_enclave * enclave)
 {
     struct enclave_fs * fs_state = &(enclave->fs_state);
 
+    /* Unpin any file pages still mapped by the enclave */
+    free_file_maps(fs_state, NULL);
+
     /* Iterate through open files and close each one.  */
     {
 	struct file_list_iter * iter = NULL;
@@ -360,5 +932,87 @@ deinit_enclave_fs(struct pisces_enclave * enclave)
     /* Delete htable */
     free_htable(fs_state->open_file_table, 0, 0);
 
+    free_percpu(fs_state->io_stats);
+
     return 0;
 }
+
+
+void
+enclave_fs_show_stats(struct seq_file       * file, 
+		      struct pisces_enclave * enclave)
+{
+    struct enclave_fs     * fs_state = &(enclave->fs_state);
+    struct file_list_iter * iter     = NULL;
+    struct vfs_io_stats   * totals   = NULL;
+    int cpu = 0;
+    int op  = 0;
+    int i   = 0;
+
+    totals = kmalloc(sizeof(struct vfs_io_stats), GFP_KERNEL);
+
+    if (!totals) {
+	seq_printf(file, "Out of memory\n");
+	return;
+    }
+
+    memset(totals, 0, sizeof(struct vfs_io_stats));
+
+    for_each_possible_cpu(cpu) {
+	struct vfs_io_stats * stats = per_cpu_ptr(fs_state->io_stats, cpu);
+
+	for (op = 0; op < VFS_NUM_STATS; op++) {
+	    totals->op[op].ops      += stats->op[op].ops;
+	    totals->op[op].errors   += stats->op[op].errors;
+	    totals->op[op].bytes    += stats->op[op].bytes;
+	    totals->op[op].total_ns += stats->op[op].total_ns;
+
+	    for (i = 0; i < VFS_LAT_BUCKETS; i++) {
+		totals->op[op].lat_hist[i] += stats->op[op].lat_hist[i];
+	    }
+	}
+    }
+
+    seq_printf(file, "%-6s %12s %8s %16s %16s\n", "op", "count", "errors", "bytes", "total_ns");
+
+    for (op = 0; op < VFS_NUM_STATS; op++) {
+	seq_printf(file, "%-6s %12llu %8llu %16llu %16llu\n", 
+		   vfs_stat_names[op],
+		   totals->op[op].ops, 
+		   totals->op[op].errors,
+		   totals->op[op].bytes, 
+		   totals->op[op].total_ns);
+    }
+
+    seq_printf(file, "\nLatency histogram (log2 ns):\n");
+
+    for (op = 0; op < VFS_NUM_STATS; op++) {
+	seq_printf(file, "%-6s", vfs_stat_names[op]);
+
+	for (i = 0; i < VFS_LAT_BUCKETS; i++) {
+	    if (totals->op[op].lat_hist[i]) {
+		seq_printf(file, " %d:%llu", i, totals->op[op].lat_hist[i]);
+	    }
+	}
+
+	seq_printf(file, "\n");
+    }
+
+    kfree(totals);
+
+    mutex_lock(&(fs_state->file_list_lock));
+    {
+	seq_printf(file, "\nOpen Files: %u\n", fs_state->num_files);
+
+	list_for_each_entry(iter, &(fs_state->open_file_list), node) {
+	    struct file * file_ptr = (struct file *)iter->file_ptr;
+
+	    seq_printf(file, "%p %s: reads=%llu (%llu bytes), writes=%llu (%llu bytes)\n",
+		       file_ptr, 
+		       file_ptr->f_path.dentry->d_name.name,
+		       iter->reads,  iter->bytes_read,
+		       iter->writes, iter->bytes_written);
+	}
+    }
+    mutex_unlock(&(fs_state->file_list_lock));
+}
@@ -5,6 +5,7 @@
 struct hashtable;
 struct pisces_enclave;
 struct pisces_cmd_buf;
+struct seq_file;
 
 
 /* LCALL Structs */
@@ -53,16 +54,136 @@ struct vfs_size_lcall {
 } __attribute__((packed));
 
 
+struct vfs_mkdir_lcall {
+    struct pisces_lcall lcall;
+    u32 perms;
+    u32 recurse;
+    u8  path[0];
+} __attribute__((packed));
+
+
+/* Directory reads:
+ *    Entries are streamed into the enclave buffers as packed vfs_dirent records.
+ *    A record never spans two buffers. The response status is the number of 
+ *    records written, and the response data is the u64 directory offset at 
+ *    which the next readdir should resume (0 records means end of directory). 
+ *    If the next entry does not fit in any of the buffers the status is -ENOSPC.
+ */
+struct vfs_readdir_lcall {
+    struct pisces_lcall lcall;
+    u64 file_handle;
+    u64 offset;
+    u32 num_descs;
+    struct vfs_buf_desc descs[0];
+} __attribute__((packed));
+
+struct vfs_dirent {
+    u64 ino;
+    u32 type;         /* DT_* value */
+    u16 rec_len;      /* Total record length, 8 byte aligned */
+    u16 name_len;     /* Excludes the NULL terminator */
+    u8  name[0];
+} __attribute__((packed));
+
+
+/* Batched metadata lcall: 
+ *    Opens and/or stats a list of paths in a single round trip 
+ */
+#define VFS_BATCH_OPEN       0x1   /* Keep each file open and return its handle */
+#define VFS_BATCH_STAT       0x2   /* Return size and mtime for each file       */
+
+#define VFS_BATCH_MAX_PATHS  1024
+
+struct vfs_path_desc {
+    u32 mode;
+    u32 path_len;    /* Includes the NULL terminator */
+    u8  path[0];
+} __attribute__((packed));
+
+struct vfs_open_batch_lcall {
+    struct pisces_lcall lcall;
+    u32 flags;
+    u32 num_paths;
+    u8  paths[0];    /* num_paths back to back vfs_path_desc entries */
+} __attribute__((packed));
+
+/* One entry per requested path is returned in the response data */
+struct vfs_file_info {
+    u64 file_handle; /* 0 if the file was not opened */
+    u64 size;
+    u64 mtime;       /* ns since the epoch */
+    s64 status;      /* 0 on success, -1 on error */
+} __attribute__((packed));
+
+
+/* Zero-copy file mapping:
+ *    Pins the page cache pages backing a file range and returns their 
+ *    physical addresses. The enclave must only map them read-only. 
+ *    Pages stay pinned until unmap, file close, or enclave teardown
+ */
+#define VFS_MAP_MAX_PAGES    4096
+
+struct vfs_map_lcall {
+    struct pisces_lcall lcall;
+    u64 file_handle;
+    u64 offset;      /* Must be page aligned */
+    u64 length;
+} __attribute__((packed));
+
+/* The response status is the map handle (0 on error), 
+ *   and the response data is an array of u64 page physical addresses 
+ */
+
+struct vfs_unmap_lcall {
+    struct pisces_lcall lcall;
+    u64 map_handle;
+} __attribute__((packed));
+
+
+
+/* I/O accounting: 
+ *    Always on, per-CPU so the lcall path never bounces a shared cache line
+ */
+#define VFS_STAT_OPEN         0
+#define VFS_STAT_READ         1
+#define VFS_STAT_WRITE        2
+#define VFS_STAT_CLOSE        3
+#define VFS_STAT_SIZE         4
+#define VFS_NUM_STATS         5
+
+#define VFS_LAT_BUCKETS       32   /* Bucket i counts ops taking [2^i, 2^(i+1)) ns */
+
+struct vfs_op_stats {
+    u64 ops;
+    u64 errors;
+    u64 bytes;
+    u64 total_ns;
+    u64 lat_hist[VFS_LAT_BUCKETS];
+};
+
+struct vfs_io_stats {
+    struct vfs_op_stats op[VFS_NUM_STATS];
+};
+
+
 struct enclave_fs {
     u32 num_files;
     struct hashtable * open_file_table;
     struct list_head   open_file_list;
+    struct mutex       file_list_lock;
+
+    struct list_head   file_map_list;
+
+    struct vfs_io_stats __percpu * io_stats;
 };
 
 
 int init_enclave_fs(struct pisces_enclave   * enclave);
 int deinit_enclave_fs(struct pisces_enclave * enclave);
 
+void enclave_fs_show_stats(struct seq_file       * file, 
+			   struct pisces_enclave * enclave);
+
 int 
 enclave_vfs_read_lcall(struct pisces_enclave    * enclave, 
 		       struct pisces_xbuf_desc  * xbuf_desc, 
@@ -88,4 +209,29 @@ enclave_vfs_size_lcall(struct pisces_enclave    * enclave,
 		       struct pisces_xbuf_desc  * xbuf_desc, 
 		       struct vfs_size_lcall    * lcall);
 
+int 
+enclave_vfs_mkdir_lcall(struct pisces_enclave   * enclave,
+			struct pisces_xbuf_desc * xbuf_desc, 
+			struct vfs_mkdir_lcall  * lcall);
+
+int 
+enclave_vfs_readdir_lcall(struct pisces_enclave    * enclave,
+			  struct pisces_xbuf_desc  * xbuf_desc, 
+			  struct vfs_readdir_lcall * lcall);
+
+int 
+enclave_vfs_map_lcall(struct pisces_enclave    * enclave,
+		      struct pisces_xbuf_desc  * xbuf_desc, 
+		      struct vfs_map_lcall     * lcall);
+
+int 
+enclave_vfs_unmap_lcall(struct pisces_enclave   * enclave,
+			struct pisces_xbuf_desc * xbuf_desc, 
+			struct vfs_unmap_lcall  * lcall);
+
+int 
+enclave_vfs_open_batch_lcall(struct pisces_enclave       * enclave,
+			     struct pisces_xbuf_desc     * xbuf_desc, 
+			     struct vfs_open_batch_lcall * lcall);
+
 #endif
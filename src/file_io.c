@@ -12,6 +12,9 @@
 #include <linux/module.h>
 #include <linux/list.h>
 #include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/fadvise.h>
 
 
 
@@ -192,19 +195,23 @@ file_close(struct file * file_ptr)
     return 0;
 }
 
-loff_t
-file_size(struct file * file_ptr) 
+static int
+__file_getattr(struct file  * file_ptr, 
+	       struct kstat * s)
 {
-    struct kstat s;
-    int ret;
-    
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3,9,5)
-    ret = vfs_getattr(file_ptr->f_path.mnt, file_ptr->f_path.dentry, &s);
+    return vfs_getattr(file_ptr->f_path.mnt, file_ptr->f_path.dentry, s);
 #else
-    ret = vfs_getattr(&file_ptr->f_path, &s);
+    return vfs_getattr(&file_ptr->f_path, s);
 #endif
+}
+
+loff_t
+file_size(struct file * file_ptr) 
+{
+    struct kstat s;
 
-    if (ret != 0) {
+    if (__file_getattr(file_ptr, &s) != 0) {
 	printk(KERN_ERR "Failed to fstat file\n");
 	return -1;
     }
@@ -212,6 +219,28 @@ file_size(struct file * file_ptr)
     return s.size;
 }
 
+int
+file_stat(struct file * file_ptr, 
+	  loff_t      * size, 
+	  u64         * mtime)
+{
+    struct kstat s;
+
+    if (__file_getattr(file_ptr, &s) != 0) {
+	printk(KERN_ERR "Failed to fstat file\n");
+	return -1;
+    }
+
+    *size  = s.size;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,18,0)
+    *mtime = timespec64_to_ns(&(s.mtime));
+#else
+    *mtime = timespec_to_ns(&(s.mtime));
+#endif
+
+    return 0;
+}
+
 ssize_t 
 file_read(struct file * file_ptr, 
 	  void        * buffer, 
@@ -235,6 +264,136 @@ file_read(struct file * file_ptr,
     return ret;
 }
 
+/* Reads are issued in aligned chunks of this size, with readahead queued one chunk ahead */
+#define BULK_READ_CHUNK (8 * 1024 * 1024)
+
+/* Starts I/O for a whole chunk without waiting for it */
+static void
+bulk_readahead(struct file * file_ptr, 
+	       loff_t        offset, 
+	       size_t        length)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,19,0)
+    /* WILLNEED is not limited by the readahead window */
+    vfs_fadvise(file_ptr, offset, length, POSIX_FADV_WILLNEED);
+#else
+    /* Readahead is capped at ra_pages, which file_read_bulk() widens to a chunk */
+    page_cache_sync_readahead(file_ptr->f_mapping, &(file_ptr->f_ra), file_ptr, 
+			      offset >> PAGE_SHIFT, DIV_ROUND_UP(length, PAGE_SIZE));
+#endif
+}
+
+ssize_t
+file_read_bulk(struct file * file_ptr, 
+	       void        * buffer, 
+	       size_t        length, 
+	       loff_t        offset)
+{
+    unsigned int ra_pages = file_ptr->f_ra.ra_pages;
+    size_t       done     = 0;
+
+    /* Like POSIX_FADV_SEQUENTIAL, the wider window sticks to the file until we're done */
+    file_ptr->f_ra.ra_pages = max_t(unsigned int, ra_pages, BULK_READ_CHUNK / PAGE_SIZE);
+
+    /* Start I/O for the first chunk before we block on it */
+    bulk_readahead(file_ptr, offset, min_t(size_t, length, BULK_READ_CHUNK));
+
+    while (done < length) {
+	loff_t  pos = offset + done;
+	size_t  len = 0;
+	ssize_t ret = 0;
+
+	/* Stop each read at a chunk boundary so later reads stay aligned */
+	len = BULK_READ_CHUNK - (pos % BULK_READ_CHUNK);
+	len = min(len, length - done);
+
+	if (done + len < length) {
+	    bulk_readahead(file_ptr, pos + len, min_t(size_t, length - done - len, BULK_READ_CHUNK));
+	}
+
+	while (len > 0) {
+	    ret = file_read(file_ptr, buffer + done, len, offset + done);
+
+	    if (ret <= 0) {
+		file_ptr->f_ra.ra_pages = ra_pages;
+		return (done > 0) ? done : ret;
+	    }
+
+	    done += ret;
+	    len  -= ret;
+	}
+    }
+
+    file_ptr->f_ra.ra_pages = ra_pages;
+
+    return done;
+}
+
+
+struct readdir_ctx {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,11,0)
+    struct dir_context   ctx;   /* Must stay first, the actor is handed a pointer to it */
+#endif
+    file_dirent_fn       fn;
+    void               * priv;
+};
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,19,0)
+static int 
+readdir_actor(struct dir_context * ctx, 
+	      const char         * name, 
+	      int                  name_len, 
+	      loff_t               offset, 
+	      u64                  ino, 
+	      unsigned int         type)
+#else 
+static int 
+readdir_actor(void         * ctx, 
+	      const char   * name, 
+	      int            name_len, 
+	      loff_t         offset, 
+	      u64            ino, 
+	      unsigned int   type)
+#endif
+{
+    struct readdir_ctx * rd_ctx = (struct readdir_ctx *)ctx;
+
+    return rd_ctx->fn(rd_ctx->priv, name, name_len, ino, type);
+}
+
+
+int
+file_readdir(struct file    * file_ptr, 
+	     loff_t         * offset, 
+	     file_dirent_fn   fn, 
+	     void           * priv)
+{
+    struct readdir_ctx rd_ctx = {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,11,0)
+	.ctx.actor = readdir_actor,
+#endif
+	.fn        = fn,
+	.priv      = priv,
+    };
+    int ret = 0;
+
+    file_ptr->f_pos = *offset;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,11,0)
+    ret = iterate_dir(file_ptr, &(rd_ctx.ctx));
+#else
+    ret = vfs_readdir(file_ptr, readdir_actor, &rd_ctx);
+#endif
+
+    if (ret < 0) {
+	printk(KERN_ERR "readdir of %p at offset %lld failed (ret=%d)\n", file_ptr, *offset, ret);
+    }
+
+    *offset = file_ptr->f_pos;
+
+    return ret;
+}
+
 
 ssize_t 
 file_write(struct file * file_ptr, 
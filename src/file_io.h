@@ -19,12 +19,36 @@ int file_close(struct file * file_ptr);
 
 loff_t file_size(struct file * file_ptr);
 
+/* Returns size in bytes and modification time in ns since the epoch */
+int file_stat(struct file * file_ptr, loff_t * size, u64 * mtime);
+
 
 ssize_t file_read(struct file * file_ptr, 
 		  void        * buffer, 
 		  size_t        length, 
 		  loff_t        offset);
 
+/* Reads length bytes in large aligned chunks, queueing readahead ahead of each chunk. 
+ * Returns the number of bytes read, which is only short on EOF or error 
+ */
+ssize_t file_read_bulk(struct file * file_ptr, 
+		       void        * buffer, 
+		       size_t        length, 
+		       loff_t        offset);
+
+/* Called once per directory entry. Return non-zero to stop the walk */
+typedef int (*file_dirent_fn)(void       * priv, 
+			      const char * name, 
+			      int          name_len, 
+			      u64          ino, 
+			      unsigned int type);
+
+/* Walks a directory starting at *offset. On return *offset is the position of the next entry */
+int file_readdir(struct file    * file_ptr, 
+		 loff_t         * offset, 
+		 file_dirent_fn   fn, 
+		 void           * priv);
+
 ssize_t file_write(struct file * file_ptr, 
 		   void        * buffer, 
 		   size_t        length, 
@@ -25,6 +25,9 @@
 #include "enclave.h"
 #include "boot.h"
 #include "pisces_boot_params.h"
+#include "pisces_scrub.h"
+#include "pisces_image_cache.h"
+#include "pisces_lock.h"
 
 int                      pisces_major_num = 0;
 struct class           * pisces_class     = NULL;
@@ -140,7 +143,46 @@ device_ioctl(struct file  * file,
 		return -EINVAL;
 	    }
 
-	    pisces_enclave_free(enclave);
+	    return pisces_enclave_free(enclave);
+	}
+	case PISCES_SCRUB_MEM: {
+	    struct pisces_scrub_range range;
+	    u64                       size = 0;
+
+	    if (!capable(CAP_SYS_ADMIN)) {
+		return -EPERM;
+	    }
+
+	    if (copy_from_user(&range, argp, sizeof(struct pisces_scrub_range)) != 0) {
+		printk(KERN_ERR "Error copying scrub range from user space\n");
+		return -EFAULT;
+	    }
+
+	    if ((range.pages == 0) || 
+		(range.pages > (~0ULL >> PAGE_SHIFT)) ||
+		(range.base_addr + (range.pages << PAGE_SHIFT) < range.base_addr)) {
+		printk(KERN_ERR "Invalid scrub range (%p, %llu pages)\n", 
+		       (void *)range.base_addr, range.pages);
+		return -EINVAL;
+	    }
+
+	    size = range.pages * PAGE_SIZE;
+
+	    if (pisces_scrub_check_offline(range.base_addr, size) != 0) {
+		printk(KERN_ERR "Refusing to scrub memory that is not offline (%p, %llu pages)\n", 
+		       (void *)range.base_addr, range.pages);
+		return -EINVAL;
+	    }
+
+	    if (pisces_enclave_mem_in_use(range.base_addr, size)) {
+		printk(KERN_ERR "Refusing to scrub memory assigned to an enclave (%p)\n", 
+		       (void *)range.base_addr);
+		return -EBUSY;
+	    }
+
+	    if (pisces_scrub_range(range.base_addr, size) != 0) {
+		return -ENOMEM;
+	    }
 
 	    break;
 	}
@@ -224,8 +266,20 @@ pisces_init(void)
 	return -1;
     }
 
+    if (pisces_scrub_init() != 0) {
+	printk(KERN_ERR "Could not initialize memory scrubber\n");
+	pisces_deinit_trampoline();
+	return -1;
+    }
+
+    pisces_image_cache_init();
+    pisces_lock_stats_init();
+
     if (alloc_chrdev_region(&dev_num, 0, MAX_ENCLAVES + 1, "pisces") < 0) {
         printk(KERN_ERR "Error allocating Pisces Char device region\n");
+	pisces_lock_stats_deinit();
+	pisces_image_cache_deinit();
+	pisces_scrub_deinit();
 	pisces_deinit_trampoline();
         return -1;
     }
@@ -239,6 +293,9 @@ pisces_init(void)
         printk(KERN_ERR "Error creating Pisces Device Class\n");
 
         unregister_chrdev_region(dev_num, 1);
+	pisces_lock_stats_deinit();
+	pisces_image_cache_deinit();
+	pisces_scrub_deinit();
 	pisces_deinit_trampoline();
         return -1;
     }
@@ -248,6 +305,9 @@ pisces_init(void)
 
         class_destroy(pisces_class);
         unregister_chrdev_region(dev_num, MAX_ENCLAVES + 1);
+	pisces_lock_stats_deinit();
+	pisces_image_cache_deinit();
+	pisces_scrub_deinit();
 	pisces_deinit_trampoline();
         return -1;
     }
@@ -260,6 +320,9 @@ pisces_init(void)
         device_destroy(pisces_class, dev_num);
         class_destroy(pisces_class);
         unregister_chrdev_region(dev_num, MAX_ENCLAVES + 1);
+	pisces_lock_stats_deinit();
+	pisces_image_cache_deinit();
+	pisces_scrub_deinit();
 	pisces_deinit_trampoline();
         return -1;
     }
@@ -307,6 +370,11 @@ pisces_exit(void)
     class_destroy(pisces_class);
 
     remove_proc_entry("pisces-dbg", pisces_proc_dir);
+
+    pisces_scrub_deinit();
+    pisces_lock_stats_deinit();
+    pisces_image_cache_deinit();
+
     remove_proc_entry(PISCES_PROC_DIR, NULL);
 
     pisces_deinit_trampoline();
@@ -252,7 +252,6 @@ typedef struct pdpe64 {
 } __attribute__((packed)) pdpe64_t;
 
 
-// We Don't support this
 typedef struct pdpe64_1GB {
     u64 present        : 1;
     u64 writable       : 1;
@@ -2,11 +2,17 @@
 #include <linux/mutex.h>
 #include <linux/percpu.h>
 #include <linux/delay.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/ktime.h>
+#include <linux/seq_file.h>
 
 #include <asm/delay.h>
+#include <asm/timex.h>
 #include <asm/desc.h>
 #include <asm/segment.h>
 #include <asm/uaccess.h>
+#include <asm/apic.h>
 
 #include "pisces_boot_params.h"
 #include "enclave.h"
@@ -14,6 +20,9 @@
 #include "pisces_ringbuf.h"
 #include "enclave_ctrl.h"
 #include "pisces_xpmem.h"
+#include "pisces_scrub.h"
+#include "pisces_image_cache.h"
+#include "pisces_decompress.h"
 
 #include "boot.h"
 #include "pgtables.h"
@@ -21,6 +30,90 @@
 
 
 
+/* 
+ * If set, boot memory past the initrd is not zeroed by Linux. 
+ * Its range is passed to the enclave, which zeroes it on demand.
+ */
+static int lazy_bootmem_zero = 0;
+module_param(lazy_bootmem_zero, int, 0644);
+MODULE_PARM_DESC(lazy_bootmem_zero, "Leave the unused boot memory tail for the enclave to zero");
+
+
+static const char * boot_phase_names[PISCES_BOOT_PHASES] = {
+    [PISCES_BOOT_LOADER_START]        = "loader_start",
+    [PISCES_BOOT_MEMSET_DONE]         = "memset_done",
+    [PISCES_BOOT_KERNEL_LOADED]       = "kernel_loaded",
+    [PISCES_BOOT_INITRD_LOADED]       = "initrd_loaded",
+    [PISCES_BOOT_PARAMS_DONE]         = "boot_params_done",
+    [PISCES_BOOT_TRAMPOLINE_DONE]     = "trampoline_done",
+    [PISCES_BOOT_SIPI_SENT]           = "sipi_sent",
+    [PISCES_BOOT_CPU_INITIALIZED]     = "cpu_initialized",
+    [PISCES_BOOT_ENCLAVE_ENTRY]       = "enclave_entry",
+    [PISCES_BOOT_ENCLAVE_MM_DONE]     = "enclave_mm_done",
+    [PISCES_BOOT_ENCLAVE_INITIALIZED] = "enclave_initialized",
+    [PISCES_BOOT_ENCLAVE_INIT_TASK]   = "enclave_init_task",
+};
+
+
+void
+pisces_boot_mark(struct pisces_enclave * enclave, 
+		 int                     phase)
+{
+    struct pisces_boot_params * boot_params = (struct pisces_boot_params *)__va(enclave->bootmem_addr_pa);
+
+    boot_params->boot_timeline[phase] = get_cycles();
+}
+
+
+void
+pisces_boot_timeline_show(struct seq_file       * s, 
+			  struct pisces_enclave * enclave)
+{
+    struct pisces_boot_params * boot_params = NULL;
+
+    u64 khz      = 0;
+    u64 start    = 0;
+    u64 prev     = 0;
+    int i        = 0;
+
+    if (enclave->bootmem_addr_pa == 0) {
+	seq_printf(s, "Enclave has not been launched\n");
+	return;
+    }
+
+    boot_params = (struct pisces_boot_params *)__va(enclave->bootmem_addr_pa);
+    start       = boot_params->boot_timeline[PISCES_BOOT_LOADER_START];
+    khz         = (boot_params->cpu_khz) ? boot_params->cpu_khz : cpu_khz;
+
+    if ((start == 0) || (khz == 0)) {
+	seq_printf(s, "Enclave has not been launched\n");
+	return;
+    }
+
+    seq_printf(s, "%-22s %20s %14s %14s\n", "phase", "tsc", "time_ns", "delta_ns");
+
+    prev = start;
+
+    for (i = 0; i < PISCES_BOOT_PHASES; i++) {
+	u64 tsc = boot_params->boot_timeline[i];
+
+	if (tsc == 0) {
+	    continue;
+	}
+
+	/* TSCs are only comparable if the enclave CPU's TSC is synchronized with Linux */
+	seq_printf(s, "%-22s %20llu %14lld %14lld\n",
+		   (boot_phase_names[i]) ? boot_phase_names[i] : "enclave_phase",
+		   tsc, 
+		   ((s64)(tsc - start) * 1000000) / (s64)khz,
+		   ((s64)(tsc - prev)  * 1000000) / (s64)khz);
+
+	prev = tsc;
+    }
+}
+
+
+
 static inline u32 
 sizeof_boot_params(struct pisces_enclave * enclave) 
 {
@@ -29,13 +122,41 @@ sizeof_boot_params(struct pisces_enclave * enclave)
 
 
 
+/* Copies a whole boot image into boot memory and logs the load throughput */
+static int
+load_image(struct file * image, 
+	   const char  * name,
+	   uintptr_t     target_addr, 
+	   u64           size)
+{
+    ktime_t start_time = ktime_get();
+    int     ret        = 0;
+    u64     usecs      = 0;
+
+    ret = pisces_image_load(image, (void *)target_addr, size);
+
+    if (ret < 0) {
+	printk(KERN_ERR "Error loading %s\n", name);
+	return -1;
+    }
+
+    usecs = ktime_to_us(ktime_sub(ktime_get(), start_time));
+
+    printk("Loaded %s (%llu bytes) in %llu usecs (%llu MB/s)%s\n", 
+	   name, size, usecs, 
+	   (usecs) ? (size / usecs) * 1000000 / (1024 * 1024) : 0,
+	   (ret == 1) ? " from the image cache" : "");
+
+    return 0;
+}
+
+
 static int 
 load_kernel(struct pisces_enclave     * enclave, 
 	    struct pisces_boot_params * boot_params, 
 	    uintptr_t                   target_addr) 
 {
     struct file * kern_image = enclave->kern_file;
-    u64           bytes_read = 0;
     
     if (kern_image == NULL) {
 	printk(KERN_ERR "Error opening kernel image\n");
@@ -45,34 +166,18 @@ load_kernel(struct pisces_enclave     * enclave,
     boot_params->kernel_addr = __pa(target_addr);
     boot_params->kernel_size = file_size(kern_image);
     
-    while (bytes_read < boot_params->kernel_size) {
-	ssize_t ret = 0;
-
-	ret = file_read(kern_image, 
-			(void *)(target_addr + bytes_read), 
-			(boot_params->kernel_size - bytes_read), 
-			bytes_read);
-	
-	if (ret <= 0) {
-	    printk(KERN_ERR "Error reading kernel image. Only read %llu bytes.\n", bytes_read);
-	    file_close(kern_image);
-	    return -1;
-	}
-
-	bytes_read += ret;
-    }
-
-    return 0;
+    return load_image(kern_image, "kernel", target_addr, boot_params->kernel_size);
 }
 
 
+/* Compressed initrds are expanded in place, so max_size bounds the decompressed size */
 static int 
 load_initrd(struct pisces_enclave     * enclave, 
 	    struct pisces_boot_params * boot_params,
-	    uintptr_t                   target_addr) 
+	    uintptr_t                   target_addr, 
+	    u64                         max_size) 
 {
     struct file * initrd_image = enclave->init_file;
-    u64           bytes_read   = 0;
     
     if (initrd_image == NULL) {
 	printk(KERN_ERR "Error opening initrd\n");
@@ -80,49 +185,226 @@ load_initrd(struct pisces_enclave     * enclave,
     }
 
     boot_params->initrd_addr = __pa(target_addr);
-    boot_params->initrd_size = file_size(initrd_image);
-    
-    while (bytes_read < boot_params->initrd_size) {
-	ssize_t ret = 0;
 
-	ret = file_read(initrd_image, 
-			(void *)(target_addr + bytes_read), 
-			(boot_params->initrd_size - bytes_read), 
-			bytes_read);
+    if (pisces_image_compression(initrd_image) != PISCES_COMPRESS_NONE) {
+	ktime_t start_time = ktime_get();
+	s64     size       = 0;
+
+	size = pisces_decompress_image(initrd_image, (void *)target_addr, max_size);
 
-	if (ret <= 0) {
-	    printk(KERN_ERR "Error reading initrd. Only read %llu bytes.\n", bytes_read);
-	    file_close(initrd_image);
+	if (size <= 0) {
+	    printk(KERN_ERR "Error decompressing initrd\n");
 	    return -1;
 	}
 
-	bytes_read += ret;
-    }
+	boot_params->initrd_size = size;
+
+	printk("Loaded compressed initrd (%llu bytes) in %llu usecs\n", 
+	       boot_params->initrd_size, 
+	       (u64)ktime_to_us(ktime_sub(ktime_get(), start_time)));
+    } else {
+	boot_params->initrd_size = file_size(initrd_image);
     
-    printk("Loaded INITRD (bytes_read = %llu)\n", bytes_read);
+	if (load_image(initrd_image, "initrd", target_addr, boot_params->initrd_size) != 0) {
+	    return -1;
+	}
+    }
+
     printk("INITRD bytes (at %p) = %x\n",         (void *)target_addr, *(unsigned int*)target_addr); 
 	   
     return 0;
 }
 
 
+/* 
+ * Lists the enclave's CPUs and memory, other than the boot CPU and boot memory, for the enclave to add at boot.
+ * Returns the number of resources listed, or -1 if they do not fit
+ */
+static int
+setup_launch_res(struct pisces_enclave    * enclave, 
+		 struct pisces_launch_res * res)
+{
+    struct enclave_mem_block * iter = NULL;
+    u32 cpu_id = 0;
+
+    BUILD_BUG_ON(sizeof(struct pisces_launch_res) > PAGE_SIZE_4KB);
+
+    memset(res, 0, sizeof(struct pisces_launch_res));
+
+    for_each_cpu(cpu_id, &(enclave->assigned_cpus)) {
+	if (cpu_id == enclave->boot_cpu) {
+	    continue;
+	}
+
+	if (res->num_cpus == PISCES_LAUNCH_RES_MAX_CPUS) {
+	    return -1;
+	}
+
+	res->cpus[res->num_cpus].cpu_id  = cpu_id;
+	res->cpus[res->num_cpus].apic_id = apic->cpu_present_to_apicid(cpu_id);
+	res->num_cpus++;
+    }
+
+    list_for_each_entry(iter, &(enclave->memdesc_list), node) {
+	if ((iter->base_addr >= enclave->bootmem_addr_pa) && 
+	    (iter->base_addr <  (enclave->bootmem_addr_pa + enclave->bootmem_size))) {
+	    /* Boot memory */
+	    continue;
+	} 
+
+	if (res->num_mem == PISCES_LAUNCH_RES_MAX_MEM) {
+	    return -1;
+	}
+
+	res->mem[res->num_mem].phys_addr = iter->base_addr;
+	res->mem[res->num_mem].size      = (u64)iter->pages * PAGE_SIZE_4KB;
+	res->num_mem++;
+    }
+
+    return res->num_cpus + res->num_mem;
+}
+
+
+/* Zeroes the boot memory past tail_offset in the background, or hands it to the enclave dirty. 
+ * Returns 1 if a scrub was started and must be waited on 
+ */
+static int
+setup_bootmem_tail(struct pisces_enclave     * enclave, 
+		   struct pisces_boot_params * boot_params, 
+		   u64                         tail_offset, 
+		   struct pisces_scrub       * tail_scrub)
+{
+    if (lazy_bootmem_zero) {
+	boot_params->bootmem_dirty  = 1;
+	boot_params->dirty_mem_addr = enclave->bootmem_addr_pa + tail_offset;
+	boot_params->dirty_mem_size = enclave->bootmem_size - tail_offset;
+
+	return 0;
+    } 
+
+    if (pisces_scrub_start(tail_scrub, enclave->bootmem_addr_pa + tail_offset, enclave->bootmem_size - tail_offset) != 0) {
+	return -1;
+    }
+
+    return 1;
+}
+
+
+static int
+setup_console_ring(struct pisces_enclave     * enclave, 
+		   struct pisces_boot_params * boot_params, 
+		   uintptr_t                   ring_addr, 
+		   u64                         ring_size)
+{
+    if (pisces_cons_init(enclave, (struct pisces_cons_ringbuf *)ring_addr, ring_size) == -1) {
+	printk(KERN_ERR "Error initializing Pisces Console\n");
+	return -1;
+    }
+
+    boot_params->console_ring_addr    = __pa(ring_addr);
+    boot_params->console_ring_size    = pisces_cons_ring_bytes(ring_size);
+    boot_params->console_ring_version = PISCES_CONS_VERSION;
+
+    if (enclave->cons.notify_vector > 0) {
+	boot_params->console_notify_apicid = apic->cpu_present_to_apicid(0);
+	boot_params->console_notify_vector = enclave->cons.notify_vector;
+    }
+
+    printk("console initialized. (target addr=%p, size=%llu)\n", 
+	   (void *)boot_params->console_ring_addr, boot_params->console_ring_size);
+
+    return 0;
+}
+
+
 int 
 setup_boot_params(struct pisces_enclave * enclave) 
 {
     uintptr_t offset = 0;
     uintptr_t base_addr = 0;
     struct pisces_boot_params * boot_params = NULL;
+    struct pisces_scrub         tail_scrub;
+
+    u64 start_tsc   = get_cycles();
+    u64 tail_offset = 0;
+    loff_t kern_size = 0;
+    loff_t init_size = 0;
+    u64 ring_offset = 0;
+    u64 ring_size   = PISCES_CONS_RING_SIZE;
+    int ring_in_tail = 0;
+    int compressed  = 0;
+    int zeroing     = 0;
+    int ret         = -1;
 
     base_addr   = (uintptr_t)__va(enclave->bootmem_addr_pa);
     boot_params = (struct pisces_boot_params *)base_addr;
 
-    memset((void *)base_addr, 0, enclave->bootmem_size);
-
     if (!boot_params) {
 	printk(KERN_ERR "Invalid address for boot parameters (%p)\n", boot_params);
 	return -1;
     }
 
+    if ((enclave->kern_file == NULL) || (enclave->init_file == NULL)) {
+	printk(KERN_ERR "Missing kernel or initrd image\n");
+	return -1;
+    }
+
+    /* 
+     * Only the loader's part of boot memory is cleared synchronously. 
+     * Everything past the 2MB aligned end of the initrd is the tail.
+     *   The size of a compressed initrd isn't known until it has been expanded,
+     *   so in that case the tail is set up after the initrd is loaded.
+     */
+    compressed  = (pisces_image_compression(enclave->init_file) != PISCES_COMPRESS_NONE);
+
+    /* Console rings larger than the default don't fit below the kernel, they go after the initrd */
+    if (enclave->console_ring_size) {
+	ring_size = enclave->console_ring_size;
+    }
+
+    ring_in_tail = (ring_size > PISCES_CONS_RING_SIZE);
+
+    kern_size = file_size(enclave->kern_file);
+    init_size = file_size(enclave->init_file);
+
+    if ((kern_size < 0) || (init_size < 0)) {
+	printk(KERN_ERR "Could not get kernel or initrd image size\n");
+	return -1;
+    }
+
+    tail_offset = ALIGN(PAGE_SIZE_2MB + kern_size + (4 * PAGE_SIZE_2MB), PAGE_SIZE_2MB);
+
+    if (!compressed) {
+	tail_offset = ALIGN(tail_offset + init_size, PAGE_SIZE_2MB);
+
+	if (ring_in_tail) {
+	    ring_offset  = tail_offset;
+	    tail_offset += ALIGN(pisces_cons_ring_bytes(ring_size), PAGE_SIZE_2MB);
+	}
+    }
+
+    if (tail_offset > enclave->bootmem_size) {
+	printk(KERN_ERR "Kernel and initrd do not fit in boot memory (need %llu bytes, have %llu)\n", 
+	       tail_offset, enclave->bootmem_size);
+	return -1;
+    }
+
+    memset((void *)base_addr, 0, PAGE_SIZE_2MB);
+
+    /* The timeline lives in the memory that was just cleared */
+    boot_params->boot_timeline[PISCES_BOOT_LOADER_START] = start_tsc;
+
+    if (!compressed) {
+	/* Zero the tail in parallel while the images are read in */
+	zeroing = setup_bootmem_tail(enclave, boot_params, tail_offset, &tail_scrub);
+
+	if (zeroing < 0) {
+	    return -1;
+	}
+    }
+
+    pisces_boot_mark(enclave, PISCES_BOOT_MEMSET_DONE);
+
 
     printk("Setting up boot parameters. BaseAddr=%p\n", (void *)base_addr);
 
@@ -142,7 +424,7 @@ setup_boot_params(struct pisces_enclave * enclave)
 		   launch_code_size,
 		   sizeof(boot_params->launch_code));
 	    
-	    return -1;
+	    goto out;
 	}
 
         memcpy(boot_params->launch_code, &launch_code_start, launch_code_size);
@@ -160,6 +442,7 @@ setup_boot_params(struct pisces_enclave * enclave)
 	strncpy(boot_params->cmd_line, enclave->kern_cmdline, 1024);
 
 	boot_params->magic              = PISCES_MAGIC;
+	boot_params->boot_params_size   = sizeof(struct pisces_boot_params);
 	boot_params->cpu_id             = enclave->boot_cpu;
 	boot_params->apic_id            = apic->cpu_present_to_apicid(enclave->boot_cpu);
 	boot_params->cpu_khz            = cpu_khz;   /* Record pre-calculated cpu speed */
@@ -177,24 +460,17 @@ setup_boot_params(struct pisces_enclave * enclave)
 
 
     /*
-     *	 Initialize Console Ring buffer (64KB)
+     *	 Initialize Console Ring buffer (64KB of data after the index pages)
      */
-    {
+    if (!ring_in_tail) {
 	offset = ALIGN(offset, PAGE_SIZE_4KB);
-	//    boot_params->console_ring_addr
 
-	if (pisces_cons_init(enclave, (struct pisces_cons_ringbuf *)(base_addr + offset)) == -1) {
-	    printk(KERN_ERR "Error initializing Pisces Console\n");
-	    return -1;
+	if (setup_console_ring(enclave, boot_params, base_addr + offset, ring_size) == -1) {
+	    goto out;
 	}
 	
-	boot_params->console_ring_addr = __pa(base_addr + offset);
-	boot_params->console_ring_size = sizeof(struct pisces_cons_ringbuf);
-	
-	offset += sizeof(struct pisces_cons_ringbuf);
-	printk("console initialized. Offset at %p (target addr=%p, size=%llu)\n", 
-	       (void *)(base_addr + offset), 
-	       (void *)boot_params->console_ring_addr, boot_params->console_ring_size);
+	offset += pisces_cons_ring_bytes(ring_size);
+	printk("\t Offset at %p\n", (void *)(base_addr + offset));
     }
 
 
@@ -209,7 +485,7 @@ setup_boot_params(struct pisces_enclave * enclave)
 
         if (pisces_ctrl_init(enclave) == -1) {
             printk(KERN_ERR "Error initializing control channel\n");
-            return -1;
+            goto out;
         }
 
         offset += PAGE_SIZE_4KB;
@@ -233,7 +509,7 @@ setup_boot_params(struct pisces_enclave * enclave)
 
         if (pisces_lcall_init(enclave) == -1) {
             printk(KERN_ERR "Error initializing Longcall channel\n");
-            return -1;
+            goto out;
         }
 
         offset += PAGE_SIZE_4KB;
@@ -256,7 +532,7 @@ setup_boot_params(struct pisces_enclave * enclave)
 #ifdef USING_XPMEM
 	if (pisces_xpmem_init(enclave) == -1) {
 	    printk(KERN_ERR "Error initializing XPMEM channel\n");
-	    return -1;
+	    goto out;
 	}
 #endif
 
@@ -268,6 +544,48 @@ setup_boot_params(struct pisces_enclave * enclave)
                 boot_params->xpmem_buf_size);
     }
 
+    /*
+     * Launch resource list (4KB)
+     *   If there is nothing to list, or too much, the resources are added after boot instead
+     */
+    {
+	struct pisces_launch_res * res = NULL;
+	int num_res = 0;
+
+        offset = ALIGN(offset, PAGE_SIZE_4KB);
+
+	res     = (struct pisces_launch_res *)(base_addr + offset);
+	num_res = setup_launch_res(enclave, res);
+
+	if (num_res > 0) {
+	    boot_params->launch_res_addr = __pa(base_addr + offset);
+	    boot_params->launch_res_size = PAGE_SIZE_4KB;
+
+	    offset += PAGE_SIZE_4KB;
+
+	    if (scrub_on_add) {
+		int i = 0;
+
+		for (i = 0; i < res->num_mem; i++) {
+		    if (pisces_scrub_range(res->mem[i].phys_addr, res->mem[i].size) != 0) {
+			printk(KERN_ERR "Error scrubbing launch memory for enclave %d\n", enclave->id);
+			goto out;
+		    }
+		}
+	    }
+
+	    printk("Launch resources (%u CPUs, %u memory blocks) listed at %p\n", 
+		   res->num_cpus, res->num_mem, 
+		   (void *)boot_params->launch_res_addr);
+	} else {
+	    if (num_res == -1) {
+		printk(KERN_WARNING "Too many launch resources to list, adding them after boot\n");
+	    }
+
+	    memset(res, 0, sizeof(struct pisces_launch_res));
+	}
+    }
+
 
     /*
      * 1. kernel image
@@ -281,16 +599,18 @@ setup_boot_params(struct pisces_enclave * enclave)
 	    printk(KERN_ERR "Error: Kitten kernel must be loaded at the 2MB offset\n");
 	    printk(KERN_ERR "\t This can only be changed if you update CONFIG_PHYSICAL_START\n" \
 		            "\t in the Kitten configuration, and update the offset check in pisces_boot_params.c\n");
-	    return -1;
+	    goto out;
 	}
 	
 	if (load_kernel(enclave, boot_params, base_addr + offset) == -1) {
 	    printk(KERN_ERR "Error loading kernel to target (%p)\n", (void *)(base_addr + offset));
-	    return -1;
+	    goto out;
 	}
 	
 	offset += boot_params->kernel_size;
 
+	pisces_boot_mark(enclave, PISCES_BOOT_KERNEL_LOADED);
+
 	printk("\t kernel loaded. Offset at %p\n", (void *)(base_addr + offset));
     }
 
@@ -302,6 +622,9 @@ setup_boot_params(struct pisces_enclave * enclave)
      */
     offset += 4 * PAGE_SIZE_2MB;
 
+    memset((void *)(base_addr + offset - (4 * PAGE_SIZE_2MB)), 0, 
+	   ALIGN(offset, PAGE_SIZE_2MB) - (offset - (4 * PAGE_SIZE_2MB)));
+
 
 
     /* 
@@ -311,17 +634,52 @@ setup_boot_params(struct pisces_enclave * enclave)
 	offset = ALIGN(offset, PAGE_SIZE_2MB);
 	
 	printk("Loading InitRD. Offset at %p\n", (void *)(base_addr + offset));
-	if (load_initrd(enclave, boot_params, base_addr + offset) == -1) {
+	if (load_initrd(enclave, boot_params, base_addr + offset, enclave->bootmem_size - offset) == -1) {
 	    printk(KERN_ERR "Error loading initrd to target (%p)\n", (void *)(base_addr + offset));
-	    return -1;
+	    goto out;
 	}
 	
 	offset += boot_params->initrd_size;
 
+	pisces_boot_mark(enclave, PISCES_BOOT_INITRD_LOADED);
+
+	if (compressed) {
+	    tail_offset = ALIGN(offset, PAGE_SIZE_2MB);
+
+	    if (ring_in_tail) {
+		ring_offset  = tail_offset;
+		tail_offset += ALIGN(pisces_cons_ring_bytes(ring_size), PAGE_SIZE_2MB);
+
+		if (tail_offset > enclave->bootmem_size) {
+		    printk(KERN_ERR "Console ring does not fit in boot memory after the initrd\n");
+		    goto out;
+		}
+	    }
+	}
+
+	/* Also clears a console ring placed after the initrd */
+	memset((void *)(base_addr + offset), 0, tail_offset - offset);
+
+	if (compressed) {
+	    zeroing = setup_bootmem_tail(enclave, boot_params, tail_offset, &tail_scrub);
+
+	    if (zeroing < 0) {
+		zeroing = 0;
+		goto out;
+	    }
+	}
+
 	printk("\tInitRD loaded. Offset at %p\n", (void *)(base_addr + offset));
     }
 
 
+    if (ring_in_tail) {
+	if (setup_console_ring(enclave, boot_params, base_addr + ring_offset, ring_size) == -1) {
+	    goto out;
+	}
+    }
+
+
     printk(KERN_INFO "Pisces loader memroy map:\n");
     printk(KERN_INFO "  kernel:        [%p, %p), size %llu\n",
 	   (void *)boot_params->kernel_addr,
@@ -331,9 +689,30 @@ setup_boot_params(struct pisces_enclave * enclave)
 	   (void *)boot_params->initrd_addr, 
 	   (void *)(boot_params->initrd_addr + boot_params->initrd_size),
 	   boot_params->initrd_size);
+    printk(KERN_INFO "  console:       [%p, %p), size %llu\n",
+	   (void *)boot_params->console_ring_addr, 
+	   (void *)(boot_params->console_ring_addr + boot_params->console_ring_size),
+	   boot_params->console_ring_size);
+
+    if (lazy_bootmem_zero) {
+	printk(KERN_INFO "  dirty memory:  [%p, %p), size %llu\n",
+	       (void *)boot_params->dirty_mem_addr, 
+	       (void *)(boot_params->dirty_mem_addr + boot_params->dirty_mem_size),
+	       boot_params->dirty_mem_size);
+    }
 
-    
-    return 0;
+    ret = 0;
+
+ out:
+    if (zeroing) {
+	pisces_scrub_wait(&tail_scrub);
+    }
+
+    if (ret == 0) {
+	pisces_boot_mark(enclave, PISCES_BOOT_PARAMS_DONE);
+    }
+
+    return ret;
 }
 
 
@@ -13,6 +13,30 @@
 #define PISCES_MAGIC 0x000FE110
 
 struct pisces_enclave;
+struct seq_file;
+
+
+/* Boot phase timeline 
+ *   Each entry holds the TSC value at which a boot phase completed (0 if it was not reached).
+ *   Phases below PISCES_BOOT_ENCLAVE_PHASES are recorded by the Linux loader,
+ *   the remaining entries are recorded by the enclave kernel.
+ */
+#define PISCES_BOOT_LOADER_START          0
+#define PISCES_BOOT_MEMSET_DONE           1
+#define PISCES_BOOT_KERNEL_LOADED         2
+#define PISCES_BOOT_INITRD_LOADED         3
+#define PISCES_BOOT_PARAMS_DONE           4   /* Includes waiting for the boot memory scrub */
+#define PISCES_BOOT_TRAMPOLINE_DONE       5
+#define PISCES_BOOT_SIPI_SENT             6
+#define PISCES_BOOT_CPU_INITIALIZED       7   /* Linux observed boot_params->initialized */
+
+#define PISCES_BOOT_ENCLAVE_PHASES        8
+#define PISCES_BOOT_ENCLAVE_ENTRY         8   /* Enclave kernel entry point */
+#define PISCES_BOOT_ENCLAVE_MM_DONE       9   /* Enclave memory management initialized */
+#define PISCES_BOOT_ENCLAVE_INITIALIZED   10  /* Enclave set boot_params->initialized */
+#define PISCES_BOOT_ENCLAVE_INIT_TASK     11  /* Enclave started its init task */
+
+#define PISCES_BOOT_PHASES                16
 
 /* Pisces Boot loader memory layout
 
@@ -21,12 +45,42 @@ struct pisces_enclave;
  * 2. Console ring buffer (64KB) // 4KB aligned
  * 3. To enclave CMD buffer  // (4KB)
  * 4. From enclave CMD buffer // (4KB)
+ * 4. Launch resource list // (4KB, only if the enclave was launched with extra resources)
  * 4. kernel image // bootmem + 2MB (MUST be loaded at the 2MB offset)
  * 5. initrd // 2M aligned
+ * 6. Remaining memory // 2M aligned, zeroed in parallel or left dirty for the enclave
  *
  */
 
 
+/* 
+ * Resources handed to the enclave at launch (4KB) 
+ *   The enclave adds these itself during boot and then sets resources_added.
+ *   resources_added must be visible no later than initialized (set it first, or in the
+ *   same store), because Linux samples it as soon as it sees initialized. 
+ *   If it is clear at that point, Linux adds the resources with control commands after boot.
+ *   The Linux trampoline stays available until every listed CPU has run the launch code.
+ */
+#define PISCES_LAUNCH_RES_MAX_CPUS  128
+#define PISCES_LAUNCH_RES_MAX_MEM   190
+
+struct pisces_launch_res {
+    u32 num_cpus;
+    u32 num_mem;
+
+    struct {
+	u32 cpu_id;
+	u32 apic_id;
+    } __attribute__((packed)) cpus[PISCES_LAUNCH_RES_MAX_CPUS];
+
+    struct {
+	u64 phys_addr;
+	u64 size;
+    } __attribute__((packed)) mem[PISCES_LAUNCH_RES_MAX_MEM];
+
+} __attribute__((packed));
+
+
 /* All addresses in this structure are physical addresses */
 struct pisces_boot_params {
 
@@ -34,7 +88,10 @@ struct pisces_boot_params {
     union {
 	u64 launch_code[8];
 	struct {
-	    u8    launch_code_asm[48];
+	    u8    launch_code_asm[32];
+	    u64   launch_code_cr3;      /* Enclave page tables, loaded by the launch code */
+	    u32   launch_code_count;    /* Incremented by each CPU that runs the launch code */
+	    u32   launch_code_rsvd;
 	    u64   launch_code_esi;
 	    u64   launch_code_target_addr;
 	} __attribute__((packed));
@@ -48,8 +105,10 @@ struct pisces_boot_params {
     union {
 	u64 flags;
 	struct {
-	    u64 initialized  : 1;
-	    u64 flags__rsvd  : 63;
+	    u64 initialized   : 1;
+	    u64 bootmem_dirty   : 1;  /* dirty_mem_* has not been zeroed */
+	    u64 resources_added : 1;  /* Set by the enclave once it owns the launch_res resources, before initialized */
+	    u64 flags__rsvd     : 61;
 	} __attribute__((packed));
     } __attribute__((packed));
     
@@ -80,7 +139,8 @@ struct pisces_boot_params {
     u64 initrd_size;
 
 
-    // The address of the ring buffer used for the early console
+    // The address and total size of the console ring (struct pisces_cons_ringbuf + data)
+    //   Large rings are placed after the initrd, the enclave must keep this range reserved
     u64 console_ring_addr;
     u64 console_ring_size;
 
@@ -99,10 +159,38 @@ struct pisces_boot_params {
     u64 base_mem_paddr;
     u64 base_mem_size;
 
+    // Boot memory that the loader did not zero (valid if bootmem_dirty is set)
+    //   The enclave must zero this range before handing it out
+    u64 dirty_mem_addr;
+    u64 dirty_mem_size;
+
+    // TSC timestamps of the boot phases (PISCES_BOOT_*)
+    u64 boot_timeline[PISCES_BOOT_PHASES];
+
+    // If boot_notify_vector is non-zero, the enclave sends an IPI with this vector
+    //   to boot_notify_apicid after it sets initialized
+    u64 boot_notify_apicid;
+    u64 boot_notify_vector;
+
+    // CPUs and memory assigned at launch in addition to the boot CPU and boot memory 
+    //   (struct pisces_launch_res, 0 if there are none)
+    u64 launch_res_addr;
+    u64 launch_res_size;
+
+    // If console_notify_vector is non-zero, the enclave sends an IPI with this vector
+    //   to console_notify_apicid when it writes to an empty console ring
+    u64 console_notify_apicid;
+    u64 console_notify_vector;
+
+    // Layout of the console ring (PISCES_CONS_VERSION)
+    u64 console_ring_version;
 
 } __attribute__((packed));
 
 
 int setup_boot_params(struct pisces_enclave * enclave);
 
+void pisces_boot_mark(struct pisces_enclave * enclave, int phase);
+void pisces_boot_timeline_show(struct seq_file * s, struct pisces_enclave * enclave);
+
 #endif
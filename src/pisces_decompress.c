@@ -0,0 +1,357 @@
+/* Pisces compressed boot image support
+ *
+ *  The compressed image is staged in a vmalloc buffer (through the boot
+ *  image cache), then decompressed directly into boot memory.
+ *
+ *  LZ4 legacy archives are a series of independent blocks that each expand
+ *  to 8MB (except the last), so every block's output offset is known up
+ *  front and the blocks are decoded in parallel on the unbound workqueue.
+ *  ZSTD images are decoded with a single context, which also handles
+ *  multiple concatenated frames.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,18,0)
+#include <linux/overflow.h>
+#endif
+#include <asm/unaligned.h>
+
+#if IS_ENABLED(CONFIG_LZ4_DECOMPRESS)
+#include <linux/lz4.h>
+#endif
+
+#if IS_ENABLED(CONFIG_ZSTD_DECOMPRESS) && (LINUX_VERSION_CODE >= KERNEL_VERSION(4,14,0))
+#include <linux/zstd.h>
+#define PISCES_ZSTD
+#endif
+
+/* 5.16 replaced the ZSTD_* kernel API with zstd_* wrappers around upstream zstd */
+#ifdef PISCES_ZSTD
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,16,0)
+typedef zstd_dctx pisces_zstd_dctx;
+#define pisces_zstd_wksp_bound()                   zstd_dctx_workspace_bound()
+#define pisces_zstd_init(wksp, size)               zstd_init_dctx(wksp, size)
+#define pisces_zstd_decompress(dctx, d, dl, s, sl) zstd_decompress_dctx(dctx, d, dl, s, sl)
+#define pisces_zstd_is_error(ret)                  zstd_is_error(ret)
+#define pisces_zstd_error_code(ret)                ((int)zstd_get_error_code(ret))
+#else
+typedef ZSTD_DCtx pisces_zstd_dctx;
+#define pisces_zstd_wksp_bound()                   ZSTD_DCtxWorkspaceBound()
+#define pisces_zstd_init(wksp, size)               ZSTD_initDCtx(wksp, size)
+#define pisces_zstd_decompress(dctx, d, dl, s, sl) ZSTD_decompressDCtx(dctx, d, dl, s, sl)
+#define pisces_zstd_is_error(ret)                  ZSTD_isError(ret)
+#define pisces_zstd_error_code(ret)                ((int)ZSTD_getErrorCode(ret))
+#endif
+#endif
+
+#if IS_ENABLED(CONFIG_LZ4_DECOMPRESS) && (LINUX_VERSION_CODE >= KERNEL_VERSION(3,11,0))
+#define PISCES_LZ4
+#endif
+
+#include "pisces_decompress.h"
+#include "pisces_image_cache.h"
+#include "file_io.h"
+
+
+#define LZ4_LEGACY_MAGIC      0x184C2102
+#define LZ4_LEGACY_BLOCK_SIZE (8 * 1024 * 1024)
+#define ZSTD_FRAME_MAGIC      0xFD2FB528
+
+
+int
+pisces_image_compression(struct file * image)
+{
+    u8  hdr[4];
+    u32 magic = 0;
+
+    if (file_read(image, hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+	return PISCES_COMPRESS_NONE;
+    }
+
+    magic = get_unaligned_le32(hdr);
+
+    if (magic == LZ4_LEGACY_MAGIC) {
+	return PISCES_COMPRESS_LZ4;
+    } else if (magic == ZSTD_FRAME_MAGIC) {
+	return PISCES_COMPRESS_ZSTD;
+    }
+
+    return PISCES_COMPRESS_NONE;
+}
+
+
+
+#ifdef PISCES_LZ4
+
+struct lz4_block_work {
+    struct work_struct   work;
+    const u8           * src;
+    u32                  src_len;
+    u8                 * dst;
+    u32                  dst_len;    /* In: capacity, Out: decompressed size */
+    int                  error;
+    atomic_t           * pending;
+    struct completion  * done;
+};
+
+
+static int
+lz4_decode_block(const u8 * src,
+		 u32        src_len,
+		 u8       * dst,
+		 u32      * dst_len)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
+    int ret = LZ4_decompress_safe((const char *)src, (char *)dst, src_len, *dst_len);
+
+    if (ret < 0) {
+	return -1;
+    }
+
+    *dst_len = ret;
+#else
+    size_t out_len = *dst_len;
+
+    if (lz4_decompress_unknownoutputsize(src, src_len, dst, &out_len) != 0) {
+	return -1;
+    }
+
+    *dst_len = out_len;
+#endif
+
+    return 0;
+}
+
+
+static void
+lz4_block_worker(struct work_struct * work)
+{
+    struct lz4_block_work * blk = container_of(work, struct lz4_block_work, work);
+
+    blk->error = lz4_decode_block(blk->src, blk->src_len, blk->dst, &(blk->dst_len));
+
+    if (atomic_dec_and_test(blk->pending)) {
+	complete(blk->done);
+    }
+}
+
+
+static s64
+lz4_image_decompress(const u8 * src,
+		     u64        src_len,
+		     u8       * dst,
+		     u64        dst_size)
+{
+    struct lz4_block_work * blocks     = NULL;
+    struct completion       done;
+    atomic_t                pending;
+
+    u64 offset     = 0;
+    u64 out_len    = 0;
+    u64 max_blocks = 0;
+    u32 num_blocks = 0;
+    u32 i          = 0;
+    s64 ret        = -1;
+
+    /* Every block but the last inflates to exactly 8MB, and blocks past dst_size are rejected */
+    max_blocks = DIV_ROUND_UP_ULL(dst_size, LZ4_LEGACY_BLOCK_SIZE);
+
+    if ((max_blocks == 0) || (max_blocks > U32_MAX)) {
+	printk(KERN_ERR "Invalid LZ4 output size (%llu bytes)\n", dst_size);
+	return -1;
+    }
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,18,0)
+    blocks = vmalloc(array_size(max_blocks, sizeof(struct lz4_block_work)));
+#else
+    blocks = vmalloc(max_blocks * sizeof(struct lz4_block_work));
+#endif
+
+    if (!blocks) {
+	printk(KERN_ERR "Could not allocate LZ4 block list\n");
+	return -1;
+    }
+
+    init_completion(&done);
+
+    /* Split the archive into blocks */
+    offset = 4;
+
+    while (src_len - offset >= 4) {
+	u32 blk_len = get_unaligned_le32(src + offset);
+	u64 blk_dst = (u64)num_blocks * LZ4_LEGACY_BLOCK_SIZE;
+
+	if (blk_len == LZ4_LEGACY_MAGIC) {
+	    /* Concatenated archives break the fixed 8MB output stride */
+	    printk(KERN_ERR "Concatenated LZ4 archives are not supported\n");
+	    goto out;
+	}
+
+	offset += 4;
+
+	if (src_len == offset) {
+	    /* Trailing uncompressed size written by some tools */
+	    break;
+	}
+
+	if (blk_len > (src_len - offset)) {
+	    printk(KERN_ERR "Truncated LZ4 block at offset %llu\n", offset - 4);
+	    goto out;
+	}
+
+	if (blk_dst >= dst_size) {
+	    printk(KERN_ERR "Decompressed image does not fit in %llu bytes\n", dst_size);
+	    goto out;
+	}
+
+	blocks[num_blocks].src     = src + offset;
+	blocks[num_blocks].src_len = blk_len;
+	blocks[num_blocks].dst     = dst + blk_dst;
+	blocks[num_blocks].dst_len = min_t(u64, LZ4_LEGACY_BLOCK_SIZE, dst_size - blk_dst);
+	blocks[num_blocks].error   = 0;
+	blocks[num_blocks].pending = &pending;
+	blocks[num_blocks].done    = &done;
+
+	num_blocks++;
+	offset += blk_len;
+    }
+
+    if (num_blocks == 0) {
+	printk(KERN_ERR "Empty LZ4 archive\n");
+	goto out;
+    }
+
+    atomic_set(&pending, num_blocks);
+
+    for (i = 0; i < num_blocks; i++) {
+	INIT_WORK(&(blocks[i].work), lz4_block_worker);
+	queue_work(system_unbound_wq, &(blocks[i].work));
+    }
+
+    wait_for_completion(&done);
+
+    for (i = 0; i < num_blocks; i++) {
+	if (blocks[i].error) {
+	    printk(KERN_ERR "Corrupt LZ4 block %u\n", i);
+	    goto out;
+	}
+
+	if ((i < num_blocks - 1) && (blocks[i].dst_len != LZ4_LEGACY_BLOCK_SIZE)) {
+	    printk(KERN_ERR "Short LZ4 block %u (%u bytes)\n", i, blocks[i].dst_len);
+	    goto out;
+	}
+
+	out_len += blocks[i].dst_len;
+    }
+
+    printk("Decompressed LZ4 image: %u blocks, %llu -> %llu bytes\n", num_blocks, src_len, out_len);
+
+    ret = out_len;
+
+ out:
+    vfree(blocks);
+
+    return ret;
+}
+
+#endif
+
+
+
+#ifdef PISCES_ZSTD
+
+static s64
+zstd_image_decompress(const u8 * src,
+		      u64        src_len,
+		      u8       * dst,
+		      u64        dst_size)
+{
+    pisces_zstd_dctx * dctx      = NULL;
+    void             * workspace = NULL;
+    size_t             wksp_size = pisces_zstd_wksp_bound();
+    size_t             ret       = 0;
+
+    workspace = vmalloc(wksp_size);
+
+    if (!workspace) {
+	printk(KERN_ERR "Could not allocate ZSTD workspace\n");
+	return -1;
+    }
+
+    dctx = pisces_zstd_init(workspace, wksp_size);
+
+    if (!dctx) {
+	printk(KERN_ERR "Could not initialize ZSTD context\n");
+	vfree(workspace);
+	return -1;
+    }
+
+    ret = pisces_zstd_decompress(dctx, dst, dst_size, src, src_len);
+
+    vfree(workspace);
+
+    if (pisces_zstd_is_error(ret)) {
+	printk(KERN_ERR "ZSTD decompression failed (error %d)\n", pisces_zstd_error_code(ret));
+	return -1;
+    }
+
+    printk("Decompressed ZSTD image: %llu -> %llu bytes\n", src_len, (u64)ret);
+
+    return ret;
+}
+
+#endif
+
+
+
+s64
+pisces_decompress_image(struct file * image,
+			void        * dst,
+			u64           dst_size)
+{
+    int    format  = pisces_image_compression(image);
+    loff_t src_len = file_size(image);
+    u8   * src     = NULL;
+    s64    ret     = -1;
+
+    if (src_len < 4) {
+	return -1;
+    }
+
+    src = vmalloc(src_len);
+
+    if (!src) {
+	printk(KERN_ERR "Could not allocate %lld bytes to stage compressed image\n", src_len);
+	return -1;
+    }
+
+    if (pisces_image_load(image, src, src_len) < 0) {
+	vfree(src);
+	return -1;
+    }
+
+    switch (format) {
+#ifdef PISCES_LZ4
+	case PISCES_COMPRESS_LZ4:
+	    ret = lz4_image_decompress(src, src_len, dst, dst_size);
+	    break;
+#endif
+#ifdef PISCES_ZSTD
+	case PISCES_COMPRESS_ZSTD:
+	    ret = zstd_image_decompress(src, src_len, dst, dst_size);
+	    break;
+#endif
+	default:
+	    printk(KERN_ERR "Compressed image format (%d) is not supported by this kernel\n", format);
+	    break;
+    }
+
+    vfree(src);
+
+    return ret;
+}
@@ -0,0 +1,27 @@
+/* Pisces compressed boot image support
+ *  Detects LZ4 (legacy format) and ZSTD compressed images and
+ *  decompresses them straight into enclave boot memory.
+ */
+
+#ifndef __PISCES_DECOMPRESS_H__
+#define __PISCES_DECOMPRESS_H__
+
+#include <linux/types.h>
+
+struct file;
+
+#define PISCES_COMPRESS_NONE  0
+#define PISCES_COMPRESS_LZ4   1
+#define PISCES_COMPRESS_ZSTD  2
+
+/* Returns the compression format of the image, based on its magic number */
+int pisces_image_compression(struct file * image);
+
+/* Decompresses the image into dst, which has room for dst_size bytes.
+ * Returns the decompressed size, or -1 on error
+ */
+s64 pisces_decompress_image(struct file * image,
+			    void        * dst,
+			    u64           dst_size);
+
+#endif
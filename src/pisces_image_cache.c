@@ -0,0 +1,432 @@
+/* Pisces boot image cache
+ *
+ *  Entries are keyed by file identity (device, inode, size, mtime), so a
+ *  modified image is never served stale. Entries for different files with
+ *  identical contents share one copy. Contents are only compared when an
+ *  image of the same size is already cached, and then a sampled hash rules
+ *  out most mismatches before a full compare.
+ *  The cache is bounded by image_cache_mb and evicts in LRU order.
+ */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/version.h>
+#include <linux/jhash.h>
+#include <linux/math64.h>
+
+#include "pisces_image_cache.h"
+#include "file_io.h"
+
+
+static int image_cache_mb = 512;
+module_param(image_cache_mb, int, 0644);
+MODULE_PARM_DESC(image_cache_mb, "Maximum memory used to cache boot images (MB, 0 disables the cache)");
+
+
+extern struct proc_dir_entry * pisces_proc_dir;
+
+struct image_data {
+    void * buf;
+    u64    size;
+    u32    hash;
+    int    hashed;    /* hash is valid, only touched under insert_lock */
+    int    refs;
+};
+
+struct image_entry {
+    dev_t               dev;
+    unsigned long       ino;
+    u64                 size;
+    u64                 mtime;
+
+    struct image_data * data;
+    struct list_head    lru_node;
+};
+
+static LIST_HEAD(image_lru);     /* Most recently used first */
+static DEFINE_MUTEX(cache_lock);
+
+/* Serializes inserts, which are the only place entries are freed (besides deinit). 
+ *  Holding it keeps every cached image_data alive without holding cache_lock.
+ */
+static DEFINE_MUTEX(insert_lock);
+static u64 cache_bytes  = 0;
+static u64 cache_hits   = 0;
+static u64 cache_misses = 0;
+
+
+
+static void
+put_image_data(struct image_data * data)
+{
+    if (--data->refs > 0) {
+	return;
+    }
+
+    cache_bytes -= data->size;
+
+    vfree(data->buf);
+    kfree(data);
+}
+
+static void
+free_entry(struct image_entry * entry)
+{
+    list_del(&(entry->lru_node));
+    put_image_data(entry->data);
+    kfree(entry);
+}
+
+
+/* Evict from the LRU tail until the cache fits in limit bytes 
+ *  Entries that share data are evicted together, so every step frees memory
+ */
+static void
+evict_entries(u64 limit)
+{
+    while ((cache_bytes > limit) && (!list_empty(&image_lru))) {
+	struct image_entry * victim = list_last_entry(&image_lru, struct image_entry, lru_node);
+	struct image_data  * data   = victim->data;
+	struct image_entry * entry  = NULL;
+	struct image_entry * tmp    = NULL;
+
+	list_for_each_entry_safe(entry, tmp, &image_lru, lru_node) {
+	    if (entry->data == data) {
+		free_entry(entry);
+	    }
+	}
+    }
+}
+
+
+static struct image_entry *
+find_entry(struct image_entry * key)
+{
+    struct image_entry * entry = NULL;
+
+    list_for_each_entry(entry, &image_lru, lru_node) {
+	if ((entry->dev   == key->dev)  &&
+	    (entry->ino   == key->ino)  &&
+	    (entry->size  == key->size) &&
+	    (entry->mtime == key->mtime)) {
+	    return entry;
+	}
+    }
+
+    return NULL;
+}
+
+
+/* Hashes 64 evenly spaced 64 byte samples, so the cost does not grow with the image */
+#define HASH_SAMPLES     64
+#define HASH_SAMPLE_LEN  64
+
+static u32
+sample_hash(void * buf, 
+	    u64    size)
+{
+    u32 hash = jhash(&size, sizeof(size), 0);
+    u32 i    = 0;
+
+    if (size <= HASH_SAMPLES * HASH_SAMPLE_LEN) {
+	return jhash(buf, size, hash);
+    }
+
+    for (i = 0; i < HASH_SAMPLES; i++) {
+	u64 off = div64_u64((size - HASH_SAMPLE_LEN) * i, HASH_SAMPLES - 1);
+
+	hash = jhash(buf + off, HASH_SAMPLE_LEN, hash);
+    }
+
+    return hash;
+}
+
+
+/* Looks for cached data with the same contents, called with insert_lock held */
+static struct image_data *
+find_data(void * buf,
+	  u64    size)
+{
+    struct image_entry  * entry     = NULL;
+    struct image_data  ** cands     = NULL;
+    struct image_data   * match     = NULL;
+    u32                   num_cands = 0;
+    u32                   max_cands = 0;
+    u32                   hash      = 0;
+    u32                   i         = 0;
+
+    /* Collect the same size candidates, then compare them without cache_lock */
+    mutex_lock(&cache_lock);
+    {
+	list_for_each_entry(entry, &image_lru, lru_node) {
+	    max_cands++;
+	}
+
+	if (max_cands > 0) {
+	    cands = kmalloc(max_cands * sizeof(struct image_data *), GFP_KERNEL);
+	}
+
+	if (cands) {
+	    list_for_each_entry(entry, &image_lru, lru_node) {
+		if (entry->data->size == size) {
+		    cands[num_cands++] = entry->data;
+		}
+	    }
+	}
+    }
+    mutex_unlock(&cache_lock);
+
+    if (num_cands > 0) {
+	hash = sample_hash(buf, size);
+    }
+
+    for (i = 0; (i < num_cands) && (!match); i++) {
+	struct image_data * data = cands[i];
+
+	if (!data->hashed) {
+	    data->hash   = sample_hash(data->buf, data->size);
+	    data->hashed = 1;
+	}
+
+	if ((data->hash == hash) &&
+	    (memcmp(data->buf, buf, size) == 0)) {
+	    match = data;
+	}
+    }
+
+    kfree(cands);
+
+    return match;
+}
+
+
+/* Caches a copy of an image that was just read into buf */
+static void
+cache_insert(struct image_entry * key,
+	     void               * buf)
+{
+    struct image_entry * entry = NULL;
+    struct image_data  * data  = NULL;
+    u64                  limit = (u64)image_cache_mb * 1024 * 1024;
+    int                  dup   = 0;
+
+    if ((key->size == 0) || (key->size > limit)) {
+	return;
+    }
+
+    entry = kmalloc(sizeof(struct image_entry), GFP_KERNEL);
+
+    if (!entry) {
+	return;
+    }
+
+    memcpy(entry, key, sizeof(struct image_entry));
+
+    mutex_lock(&insert_lock);
+
+    /* Another launch may have missed on the same image and cached it first */
+    mutex_lock(&cache_lock);
+    {
+	dup = (find_entry(key) != NULL);
+    }
+    mutex_unlock(&cache_lock);
+
+    if (dup) {
+	kfree(entry);
+	goto out;
+    }
+
+    data = find_data(buf, key->size);
+
+    if (!data) {
+	data = kzalloc(sizeof(struct image_data), GFP_KERNEL);
+
+	if (data) {
+	    data->buf = vmalloc(key->size);
+	}
+
+	if ((!data) || (!data->buf)) {
+	    printk(KERN_ERR "Could not allocate %llu bytes to cache boot image\n", key->size);
+	    kfree(data);
+	    kfree(entry);
+	    goto out;
+	}
+
+	memcpy(data->buf, buf, key->size);
+
+	data->size = key->size;
+    }
+
+    mutex_lock(&cache_lock);
+    {
+	if (data->refs > 0) {
+	    /* Same contents under a different file, share the copy */
+	    data->refs++;
+	} else {
+	    evict_entries(limit - key->size);
+
+	    data->refs   = 1;
+	    cache_bytes += key->size;
+	}
+
+	entry->data = data;
+	list_add(&(entry->lru_node), &image_lru);
+    }
+    mutex_unlock(&cache_lock);
+
+ out:
+    mutex_unlock(&insert_lock);
+}
+
+
+int
+pisces_image_load(struct file * image,
+		  void        * dst,
+		  u64           size)
+{
+    struct inode       * inode = image->f_path.dentry->d_inode;
+    struct image_entry * entry = NULL;
+    struct image_entry   key;
+    loff_t  f_size = 0;
+    ssize_t ret    = 0;
+    int     hit    = 0;
+
+    memset(&key, 0, sizeof(struct image_entry));
+
+    if (file_stat(image, &f_size, &(key.mtime)) != 0) {
+	printk(KERN_ERR "Could not stat boot image\n");
+	return -1;
+    }
+
+    key.dev  = inode->i_sb->s_dev;
+    key.ino  = inode->i_ino;
+    key.size = f_size;
+
+    if (key.size != size) {
+	printk(KERN_ERR "Boot image changed size (expected %llu bytes, found %llu)\n", size, key.size);
+	return -1;
+    }
+
+    mutex_lock(&cache_lock);
+    {
+	entry = find_entry(&key);
+
+	if (entry) {
+	    memcpy(dst, entry->data->buf, size);
+	    list_move(&(entry->lru_node), &image_lru);
+
+	    cache_hits++;
+	    hit = 1;
+	} else {
+	    cache_misses++;
+	}
+    }
+    mutex_unlock(&cache_lock);
+
+    if (hit) {
+	return 1;
+    }
+
+    ret = file_read_bulk(image, dst, size, 0);
+
+    if ((ret < 0) || ((u64)ret != size)) {
+	printk(KERN_ERR "Error reading boot image. Only read %ld of %llu bytes.\n", (long)ret, size);
+	return -1;
+    }
+
+    if (image_cache_mb > 0) {
+	cache_insert(&key, dst);
+    }
+
+    return 0;
+}
+
+
+
+static int
+image_cache_proc_show(struct seq_file * s,
+		      void            * v)
+{
+    struct image_entry * entry = NULL;
+
+    mutex_lock(&cache_lock);
+    {
+	seq_printf(s, "Cache: %llu of %d MB used, %llu hits, %llu misses\n",
+		   cache_bytes / (1024 * 1024), image_cache_mb,
+		   cache_hits, cache_misses);
+
+	list_for_each_entry(entry, &image_lru, lru_node) {
+	    seq_printf(s, "dev %u:%u ino %lu: %llu bytes, mtime %llu, %d refs\n",
+		       MAJOR(entry->dev), MINOR(entry->dev),
+		       entry->ino,
+		       entry->size,
+		       entry->mtime,
+		       entry->data->refs);
+	}
+    }
+    mutex_unlock(&cache_lock);
+
+    return 0;
+}
+
+static int
+image_cache_proc_open(struct inode * inode,
+		      struct file  * filp)
+{
+    return single_open(filp, image_cache_proc_show, NULL);
+}
+
+static struct file_operations image_cache_proc_ops = {
+    .owner     = THIS_MODULE,
+    .open      = image_cache_proc_open,
+    .read      = seq_read,
+    .llseek    = seq_lseek,
+    .release   = single_release,
+};
+
+
+
+int
+pisces_image_cache_init(void)
+{
+    struct proc_dir_entry * cache_entry = NULL;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
+    cache_entry = create_proc_entry("image_cache", 0444, pisces_proc_dir);
+
+    if (cache_entry) {
+	cache_entry->proc_fops = &image_cache_proc_ops;
+    }
+#else
+    cache_entry = proc_create_data("image_cache", 0444, pisces_proc_dir, &image_cache_proc_ops, NULL);
+#endif
+
+    if (!cache_entry) {
+	printk(KERN_ERR "Error creating image cache proc file\n");
+    }
+
+    return 0;
+}
+
+
+void
+pisces_image_cache_deinit(void)
+{
+    remove_proc_entry("image_cache", pisces_proc_dir);
+
+    mutex_lock(&insert_lock);
+    mutex_lock(&cache_lock);
+    {
+	evict_entries(0);
+    }
+    mutex_unlock(&cache_lock);
+    mutex_unlock(&insert_lock);
+}
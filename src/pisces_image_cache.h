@@ -0,0 +1,23 @@
+/* Pisces boot image cache
+ *  Keeps pinned copies of recently loaded kernel and initrd images,
+ *  so relaunching an enclave does not go back to the filesystem.
+ */
+
+#ifndef __PISCES_IMAGE_CACHE_H__
+#define __PISCES_IMAGE_CACHE_H__
+
+#include <linux/types.h>
+
+struct file;
+
+/* Copies size bytes of the image into dst, from the cache if possible.
+ * Returns 1 on a cache hit, 0 if the image was read from the file, -1 on error
+ */
+int pisces_image_load(struct file * image,
+		      void        * dst,
+		      u64           size);
+
+int  pisces_image_cache_init(void);
+void pisces_image_cache_deinit(void);
+
+#endif
@@ -12,12 +12,21 @@
 /* Pisces global cmds */
 #define PISCES_LOAD_IMAGE               1001
 #define PISCES_FREE_ENCLAVE             1003
+#define PISCES_SCRUB_MEM                1004
 
 /* Pisces enclave cmds */
 #define PISCES_ENCLAVE_LAUNCH           2000
 #define PISCES_ENCLAVE_RESET            2001
 #define PISCES_ENCLAVE_CONS_CONNECT     2004
 #define PISCES_ENCLAVE_CTRL_CONNECT     2005
+#define PISCES_ENCLAVE_LAUNCH_RES       2006
+
+
+/* Console ring sizes (bytes of data) that can be requested at launch 
+ *  Must be a power of two, 0 selects the 64KB default 
+ */
+#define PISCES_CONS_MIN_RING_SIZE (64 * 1024)
+#define PISCES_CONS_MAX_RING_SIZE (16 * 1024 * 1024)
 
 
 struct enclave_boot_env {
@@ -25,6 +34,74 @@ struct enclave_boot_env {
     unsigned long long block_size;
     unsigned int       num_blocks;
     unsigned int       cpu_id;
+    unsigned long long console_ring_size;
+} __attribute__((packed));
+
+
+struct pisces_mem_range {
+    unsigned long long base_addr;
+    unsigned long long pages;
+} __attribute__((packed));
+
+/* Launch with the enclave's complete resource assignment
+ *  cpus points to num_cpus CPU ids, the first one is the boot CPU 
+ *  mem_ranges points to num_mem_ranges ranges, the first one is boot memory
+ */
+struct enclave_launch_res {
+    unsigned int       num_cpus;
+    unsigned int       num_mem_ranges;
+    unsigned long long cpus;
+    unsigned long long mem_ranges;
+    unsigned long long console_ring_size;
+} __attribute__((packed));
+
+
+/* Must be offlined memory that is not assigned to an enclave */
+struct pisces_scrub_range {
+    unsigned long long base_addr;
+    unsigned long long pages;
+} __attribute__((packed));
+
+
+/* Enclave console ring, mmap()ed from the console fd
+ *  Offset 0 maps the whole ring read-only: this header, the producer page, then the data.
+ *  Offset PISCES_CONS_TAIL_OFFSET maps just the consumer page read-write, 
+ *    this is only allowed while the fd is the console's only reader.
+ *  head and tail are free running byte counters, data starts at (tail & mask).
+ *  Advance tail only after you are done with the data, and don't mix this with read().
+ */
+#define PISCES_CONS_HEAD_OFFSET 64
+#define PISCES_CONS_TAIL_OFFSET 4096
+#define PISCES_CONS_DATA_OFFSET 8192
+
+struct pisces_cons_ring_hdr {
+    unsigned int       magic;
+    unsigned int       version;
+    unsigned long long size;
+    unsigned long long mask;
+    unsigned int       flags;
+    unsigned int       rsvd;
+} __attribute__((packed));
+
+/* Ring flags */
+#define PISCES_CONS_FLAG_RECORDS 0x1    /* The ring holds struct pisces_cons_record entries */
+
+
+/* Console record
+ *  In the ring, records start on PISCES_CONS_REC_ALIGN boundaries and never wrap,
+ *  a PISCES_CONS_REC_PAD record fills the space up to the end of the ring.
+ *  read() returns whole records packed back to back, without the padding.
+ */
+#define PISCES_CONS_REC_ALIGN 16
+#define PISCES_CONS_REC_PAD   0x1
+
+struct pisces_cons_record {
+    unsigned int       len;       /* Bytes of msg */
+    unsigned short     cpu;
+    unsigned char      level;     /* printk severity (0 - 7) */
+    unsigned char      flags;
+    unsigned long long tsc;
+    char               msg[0];
 } __attribute__((packed));
 
 
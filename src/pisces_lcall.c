@@ -98,6 +98,21 @@ static int lcall_kern_thread(void * arg) {
             case PISCES_LCALL_VFS_SIZE:
                 enclave_vfs_size_lcall(enclave, xbuf_desc, (struct vfs_size_lcall   *)cur_lcall);
                 break;
+            case PISCES_LCALL_VFS_MKDIR:
+                enclave_vfs_mkdir_lcall(enclave, xbuf_desc, (struct vfs_mkdir_lcall   *)cur_lcall);
+                break;
+            case PISCES_LCALL_VFS_READDIR:
+                enclave_vfs_readdir_lcall(enclave, xbuf_desc, (struct vfs_readdir_lcall *)cur_lcall);
+                break;
+            case PISCES_LCALL_VFS_OPEN_BATCH:
+                enclave_vfs_open_batch_lcall(enclave, xbuf_desc, (struct vfs_open_batch_lcall *)cur_lcall);
+                break;
+            case PISCES_LCALL_VFS_MAP:
+                enclave_vfs_map_lcall(enclave, xbuf_desc, (struct vfs_map_lcall     *)cur_lcall);
+                break;
+            case PISCES_LCALL_VFS_UNMAP:
+                enclave_vfs_unmap_lcall(enclave, xbuf_desc, (struct vfs_unmap_lcall *)cur_lcall);
+                break;
 #ifdef USING_XPMEM
             case PISCES_LCALL_XPMEM_CMD_EX:
                 pisces_xpmem_cmd_lcall(enclave, xbuf_desc, cur_lcall);
@@ -123,7 +138,6 @@ static int lcall_kern_thread(void * arg) {
                 enclave_pci_cmd(enclave, xbuf_desc, (struct pci_cmd_lcall *)cur_lcall);
                 break;
 #endif
-            case PISCES_LCALL_VFS_READDIR:
             default:
                 printk(KERN_ERR "Enclave requested unimplemented LCALL %llu\n", cur_lcall->lcall);
                 resp.status = -1;
@@ -21,6 +21,9 @@
 #define PISCES_LCALL_VFS_SIZE           (KERN_LCALL_START + 4)
 #define PISCES_LCALL_VFS_MKDIR          (KERN_LCALL_START + 5)
 #define PISCES_LCALL_VFS_READDIR        (KERN_LCALL_START + 6)
+#define PISCES_LCALL_VFS_OPEN_BATCH     (KERN_LCALL_START + 7)
+#define PISCES_LCALL_VFS_MAP            (KERN_LCALL_START + 8)
+#define PISCES_LCALL_VFS_UNMAP          (KERN_LCALL_START + 9)
 
 #define PISCES_LCALL_PCI_ACK_IRQ        (KERN_LCALL_START + 100)
 #define PISCES_LCALL_PCI_CMD            (KERN_LCALL_START + 101)
@@ -3,9 +3,42 @@
  */
 
 
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/kernel.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/version.h>
+#include <linux/atomic.h>
+#include <asm/timex.h>
+
 #include "pisces_lock.h"
 
 
+static int lock_stats = 0;
+module_param(lock_stats, int, 0644);
+MODULE_PARM_DESC(lock_stats, "Count cross OS lock acquisitions, contention, and spin cycles (0 = off)");
+
+
+/* Most PAUSEs a ticket waiter spends between polls */
+#define PISCES_LOCK_MAX_BACKOFF 1024
+
+/* Ticket waiters pause this many times for each waiter ahead of them */
+#define PISCES_TICKET_BACKOFF   64
+
+
+extern struct proc_dir_entry * pisces_proc_dir;
+
+struct lock_stats {
+    atomic64_t acquired;
+    atomic64_t contended;
+    atomic64_t spin_cycles;
+};
+
+static struct lock_stats spin_stats;
+static struct lock_stats ticket_stats;
+
+
 
 /* REP NOP (PAUSE) is a good thing to insert into busy-wait loops. */
 static inline void pisces_cpu_relax(void) {
@@ -28,6 +61,38 @@ pisces_xchg8(volatile void * ptr,
   return x;
 }
 
+static inline u32
+pisces_xadd32(volatile u32 * ptr,
+	      u32            x)
+{
+    __asm__ __volatile__("lock; xaddl %0,%1"
+			 :"+r" (x), "+m" (*ptr)
+			 :
+			 :"memory");
+    return x;
+}
+
+
+static inline void
+pisces_backoff(u32 pauses)
+{
+    while (pauses--) {
+	pisces_cpu_relax();
+    }
+}
+
+static inline void
+account_lock(struct lock_stats * stats,
+	     cycles_t            start)
+{
+    atomic64_inc(&(stats->acquired));
+
+    if (start) {
+	atomic64_inc(&(stats->contended));
+	atomic64_add(get_cycles() - start, &(stats->spin_cycles));
+    }
+}
+
 
 
 void pisces_lock_init(struct pisces_spinlock * lock) {
@@ -36,13 +101,27 @@ void pisces_lock_init(struct pisces_spinlock * lock) {
 
 
 void pisces_spin_lock(struct pisces_spinlock * lock) {
+    cycles_t start = 0;
 
     while (1) {
 	if (pisces_xchg8(&(lock->raw_lock), 1) == 0) {
-	    return;
+	    break;
+	}
+
+	if ((lock_stats) && (start == 0)) {
+	    start = get_cycles();
+	}
+
+	/* Spin on a read like the enclave side does, backing off here would only 
+	 * hand the lock to the enclave's tighter xchg loop 
+	 */
+	while (*(volatile u64 *)&(lock->raw_lock)) {
+	    pisces_cpu_relax();
 	}
+    }
 
-	while (lock->raw_lock) pisces_cpu_relax();
+    if (lock_stats) {
+	account_lock(&spin_stats, start);
     }
 }
 
@@ -51,3 +130,117 @@ void pisces_spin_unlock(struct pisces_spinlock * lock) {
     __asm__ __volatile__ ("": : :"memory");
     lock->raw_lock = 0;
 }
+
+
+
+void pisces_ticket_lock_init(struct pisces_ticket_lock * lock) {
+    lock->next  = 0;
+    lock->owner = 0;
+}
+
+
+void pisces_ticket_lock(struct pisces_ticket_lock * lock) {
+    cycles_t start  = 0;
+    u32      ticket = pisces_xadd32(&(lock->next), 1);
+
+    while (1) {
+	u32 ahead = ticket - *(volatile u32 *)&(lock->owner);
+
+	if (ahead == 0) {
+	    break;
+	}
+
+	if ((lock_stats) && (start == 0)) {
+	    start = get_cycles();
+	}
+
+	/* Grants are in order, so wait in proportion to the queue ahead of us */
+	pisces_backoff(min_t(u32, ahead * PISCES_TICKET_BACKOFF, PISCES_LOCK_MAX_BACKOFF));
+    }
+
+    __asm__ __volatile__ ("": : :"memory");
+
+    if (lock_stats) {
+	account_lock(&ticket_stats, start);
+    }
+}
+
+
+void pisces_ticket_unlock(struct pisces_ticket_lock * lock) {
+    __asm__ __volatile__ ("": : :"memory");
+    *(volatile u32 *)&(lock->owner) = lock->owner + 1;
+}
+
+
+
+
+static void
+show_lock_stats(struct seq_file   * s,
+		const char        * name,
+		struct lock_stats * stats)
+{
+    seq_printf(s, "%s: %lld acquired, %lld contended, %lld spin cycles\n",
+	       name, 
+	       (long long)atomic64_read(&(stats->acquired)),
+	       (long long)atomic64_read(&(stats->contended)),
+	       (long long)atomic64_read(&(stats->spin_cycles)));
+}
+
+static int
+lock_stats_proc_show(struct seq_file * s,
+		     void            * v)
+{
+    if (!lock_stats) {
+	seq_printf(s, "Lock statistics are disabled (lock_stats=0)\n");
+    }
+
+    show_lock_stats(s, "spinlock", &spin_stats);
+    show_lock_stats(s, "ticket",   &ticket_stats);
+
+    return 0;
+}
+
+static int
+lock_stats_proc_open(struct inode * inode,
+		     struct file  * filp)
+{
+    return single_open(filp, lock_stats_proc_show, NULL);
+}
+
+static struct file_operations lock_stats_proc_ops = {
+    .owner     = THIS_MODULE,
+    .open      = lock_stats_proc_open,
+    .read      = seq_read,
+    .llseek    = seq_lseek,
+    .release   = single_release,
+};
+
+
+int
+pisces_lock_stats_init(void)
+{
+    struct proc_dir_entry * stats_entry = NULL;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
+    stats_entry = create_proc_entry("lock_stats", 0444, pisces_proc_dir);
+
+    if (stats_entry) {
+	stats_entry->proc_fops = &lock_stats_proc_ops;
+    }
+#else
+    stats_entry = proc_create_data("lock_stats", 0444, pisces_proc_dir, &lock_stats_proc_ops, NULL);
+#endif
+
+    if (!stats_entry) {
+	printk(KERN_ERR "Error creating lock stats proc file\n");
+    }
+
+    return 0;
+}
+
+
+void
+pisces_lock_stats_deinit(void)
+{
+    remove_proc_entry("lock_stats", pisces_proc_dir);
+}
@@ -14,9 +14,27 @@ struct pisces_spinlock {
 } __attribute__((packed));
 
 
+/* FIFO ticket lock, the same size as pisces_spinlock
+ *  A waiter takes a ticket from next and spins until owner reaches it. 
+ *  Both sides of a shared structure must use the same lock type.
+ */
+struct pisces_ticket_lock {
+    u32 next;
+    u32 owner;
+} __attribute__((packed));
+
+
 void pisces_lock_init(struct pisces_spinlock * lock);
 void pisces_spin_lock(struct pisces_spinlock * lock);
 void pisces_spin_unlock(struct pisces_spinlock * lock);
 
+void pisces_ticket_lock_init(struct pisces_ticket_lock * lock);
+void pisces_ticket_lock(struct pisces_ticket_lock * lock);
+void pisces_ticket_unlock(struct pisces_ticket_lock * lock);
+
+
+/* /proc/pisces/lock_stats */
+int  pisces_lock_stats_init(void);
+void pisces_lock_stats_deinit(void);
 
 #endif
@@ -6,6 +6,7 @@
 
 
 #include <linux/module.h>
+#include <linux/log2.h>
 #include "pisces_ringbuf.h"
 
 static inline u8 * get_read_ptr(struct pisces_early_ringbuf * ring) {
@@ -144,3 +145,220 @@ int pisces_early_ringbuf_is_full(struct pisces_early_ringbuf * ring) {
 int pisces_early_ringbuf_is_empty(struct pisces_early_ringbuf * ring) {
     return ring->cur_len == 0;
 }
+
+
+
+
+#define msg_rec_len(len) \
+    (((len) + sizeof(struct pisces_msg_hdr) + PISCES_MSG_ALIGN - 1) & ~(PISCES_MSG_ALIGN - 1ULL))
+
+
+int 
+pisces_msg_ring_init(struct pisces_msg_ring * ring, 
+		     u64                      size, 
+		     u32                      flags)
+{
+    /* Producer and consumer indices each get their own cache line */
+    BUILD_BUG_ON(offsetof(struct pisces_msg_ring, head) != 64);
+    BUILD_BUG_ON(offsetof(struct pisces_msg_ring, tail) != 128);
+
+    if ((size < PISCES_MSG_RING_MIN_SIZE) || (!is_power_of_2(size))) {
+	printk(KERN_ERR "Invalid message ring size (%llu)\n", size);
+	return -1;
+    }
+
+    memset(ring, 0, sizeof(struct pisces_msg_ring));
+
+    ring->size  = size;
+    ring->mask  = size - 1;
+    ring->flags = flags;
+    pisces_ticket_lock_init(&(ring->prod_lock));
+
+    /* Publish the layout before the magic */
+    smp_wmb();
+    ring->magic = PISCES_MSG_RING_MAGIC;
+
+    return 0;
+}
+
+
+/* Writes one message at *head, returns -1 if it does not fit */
+static int
+msg_ring_put(struct pisces_msg_ring * ring, 
+	     u64                    * head, 
+	     u64                      tail, 
+	     void                   * msg, 
+	     u32                      len)
+{
+    struct pisces_msg_hdr * hdr = NULL;
+    u64 rec    = msg_rec_len(len);
+    u64 idx    = *head & ring->mask;
+    u64 contig = ring->size - idx;
+    u64 need   = (rec > contig) ? (contig + rec) : rec;
+
+    if (need > ring->size - (*head - tail)) {
+	return -1;
+    }
+
+    if (rec > contig) {
+	hdr        = (struct pisces_msg_hdr *)(ring->buf + idx);
+	hdr->len   = 0;
+	hdr->flags = PISCES_MSG_PAD;
+
+	*head += contig;
+	idx    = 0;
+    }
+
+    hdr        = (struct pisces_msg_hdr *)(ring->buf + idx);
+    hdr->len   = len;
+    hdr->flags = 0;
+    memcpy(hdr + 1, msg, len);
+
+    *head += rec;
+
+    return 0;
+}
+
+
+int
+pisces_msg_ring_enqueue_batch(struct pisces_msg_ring * ring, 
+			      void                  ** msgs, 
+			      u32                    * lens, 
+			      u32                      num_msgs)
+{
+    int mpsc = (ring->flags & PISCES_MSG_RING_MPSC);
+    u64 head = 0;
+    u64 tail = 0;
+    u32 i    = 0;
+
+    if (mpsc) {
+	pisces_ticket_lock(&(ring->prod_lock));
+    }
+
+    head = *(volatile u64 *)&(ring->head);
+    tail = *(volatile u64 *)&(ring->tail);
+
+    /* Don't overwrite data before the consumer is done reading it */
+    smp_mb();
+
+    for (i = 0; i < num_msgs; i++) {
+	if (msg_ring_put(ring, &head, tail, msgs[i], lens[i]) != 0) {
+	    break;
+	}
+    }
+
+    if (i > 0) {
+	/* Publish the data before the head that covers it */
+	smp_wmb();
+	*(volatile u64 *)&(ring->head) = head;
+    }
+
+    if (mpsc) {
+	pisces_ticket_unlock(&(ring->prod_lock));
+    }
+
+    return i;
+}
+
+
+int
+pisces_msg_ring_dequeue_batch(struct pisces_msg_ring * ring, 
+			      u8                     * buf, 
+			      u64                      buf_len,
+			      u32                    * lens, 
+			      u32                      max_msgs)
+{
+    u64 head   = *(volatile u64 *)&(ring->head);
+    u64 tail   = ring->tail;
+    u64 copied = 0;
+    u32 cnt    = 0;
+    int ret    = 0;
+
+    if (head - tail > ring->size) {
+	printk(KERN_ERR "Message ring overrun (head=%llu, tail=%llu)\n", head, tail);
+	return -1;
+    }
+
+    /* Don't read the data before we've seen the head that covers it */
+    smp_rmb();
+
+    while ((tail != head) && (cnt < max_msgs)) {
+	struct pisces_msg_hdr * hdr = (struct pisces_msg_hdr *)(ring->buf + (tail & ring->mask));
+	u64 contig = ring->size - (tail & ring->mask);
+
+	/* The header is shared with other producers, read it exactly once */
+	u32 len    = *(volatile u32 *)&(hdr->len);
+	u32 flags  = *(volatile u32 *)&(hdr->flags);
+
+	if ((flags & PISCES_MSG_PAD) && (contig <= head - tail)) {
+	    tail += contig;
+	    continue;
+	}
+
+	if ((flags & PISCES_MSG_PAD) ||
+	    (msg_rec_len(len) > contig) || 
+	    (msg_rec_len(len) > head - tail)) {
+	    /* Producer state is corrupt, drop everything */
+	    printk(KERN_ERR "Corrupt message in ring (len=%u, flags=%x), resetting\n", len, flags);
+	    tail = head;
+	    ret  = -1;
+	    break;
+	}
+
+	if (len > buf_len - copied) {
+	    if (cnt == 0) {
+		ret = -1;
+	    }
+	    break;
+	}
+
+	memcpy(buf + copied, hdr + 1, len);
+
+	lens[cnt] = len;
+	copied   += len;
+	tail     += msg_rec_len(len);
+	cnt++;
+    }
+
+    if (tail != ring->tail) {
+	/* Finish reading before the producer can reuse the space */
+	smp_mb();
+	*(volatile u64 *)&(ring->tail) = tail;
+    }
+
+    return (ret == -1) ? -1 : cnt;
+}
+
+
+int 
+pisces_msg_ring_enqueue(struct pisces_msg_ring * ring, 
+			void                   * msg, 
+			u32                      len)
+{
+    return (pisces_msg_ring_enqueue_batch(ring, &msg, &len, 1) == 1) ? 0 : -1;
+}
+
+
+s64
+pisces_msg_ring_dequeue(struct pisces_msg_ring * ring, 
+			void                   * msg, 
+			u32                      len)
+{
+    u32 msg_len = 0;
+    int cnt     = 0;
+
+    cnt = pisces_msg_ring_dequeue_batch(ring, msg, len, &msg_len, 1);
+
+    if (cnt <= 0) {
+	return cnt;
+    }
+
+    return msg_len;
+}
+
+
+int 
+pisces_msg_ring_is_empty(struct pisces_msg_ring * ring) 
+{
+    return *(volatile u64 *)&(ring->head) == ring->tail;
+}
@@ -41,4 +41,85 @@ int pisces_early_ringbuf_is_full(struct pisces_early_ringbuf * ring);
 int pisces_early_ringbuf_is_empty(struct pisces_early_ringbuf * ring);
 
 
+
+
+/* Variable length message ring, laid out for sharing between OSes
+ *   The producer owns head and the consumer owns tail, both are free running byte counts,
+ *   each on its own cache line. Data is at buf[idx & mask].
+ *   Each message is a struct pisces_msg_hdr followed by len bytes, padded to PISCES_MSG_ALIGN.
+ *   A message never wraps, the producer fills the end of the buffer with a PISCES_MSG_PAD
+ *   header instead. 
+ *   SPSC rings are lock free. With PISCES_MSG_RING_MPSC producers serialize on prod_lock.
+ */
+#define PISCES_MSG_RING_MAGIC     0x50534d52   /* "RMSP" */
+#define PISCES_MSG_RING_MIN_SIZE  64
+
+#define PISCES_MSG_RING_MPSC      0x1
+
+#define PISCES_MSG_ALIGN          8
+#define PISCES_MSG_PAD            0x1
+
+struct pisces_msg_hdr {
+    u32 len;
+    u32 flags;       /* PISCES_MSG_PAD */
+} __attribute__((packed));
+
+struct pisces_msg_ring {
+    /* Written once at init */
+    u32 magic;
+    u32 flags;       /* PISCES_MSG_RING_* */
+    u64 size;        /* Power of two */
+    u64 mask;
+    struct pisces_ticket_lock prod_lock;
+    u8  rsvd0[32];
+
+    u64 head;
+    u8  rsvd1[56];
+
+    u64 tail;
+    u8  rsvd2[56];
+
+    u8  buf[0];
+} __attribute__((packed));
+
+/* Bytes of shared memory needed for a ring with size bytes of data */
+#define pisces_msg_ring_bytes(size) (sizeof(struct pisces_msg_ring) + (size))
+
+/* Largest message that is guaranteed to fit in an empty ring */
+#define pisces_msg_ring_max_msg(ring) \
+    (((ring)->size / 2) - sizeof(struct pisces_msg_hdr))
+
+
+int pisces_msg_ring_init(struct pisces_msg_ring * ring, 
+			 u64                      size, 
+			 u32                      flags);
+
+/* Returns the number of messages enqueued, these are always the first ones */
+int pisces_msg_ring_enqueue_batch(struct pisces_msg_ring * ring, 
+				  void                  ** msgs, 
+				  u32                    * lens, 
+				  u32                      num_msgs);
+
+/* Copies messages back to back into buf, and their lengths into lens.
+ * Returns the number of messages dequeued, or -1 if the next message does not fit in buf
+ */
+int pisces_msg_ring_dequeue_batch(struct pisces_msg_ring * ring, 
+				  u8                     * buf, 
+				  u64                      buf_len,
+				  u32                    * lens, 
+				  u32                      max_msgs);
+
+/* 0 on success, -1 if the ring is full */
+int pisces_msg_ring_enqueue(struct pisces_msg_ring * ring, 
+			    void                   * msg, 
+			    u32                      len);
+
+/* Returns the message length, 0 if the ring is empty, or -1 on error */
+s64 pisces_msg_ring_dequeue(struct pisces_msg_ring * ring, 
+			    void                   * msg, 
+			    u32                      len);
+
+int pisces_msg_ring_is_empty(struct pisces_msg_ring * ring);
+
+
 #endif
@@ -0,0 +1,353 @@
+/* Pisces physical memory scrubbing
+ *
+ *  Ranges are split into chunks, and each chunk is zeroed with non-temporal
+ *  stores by a worker bound to a CPU on the chunk's NUMA node. If a node
+ *  has no online CPUs its chunks go to the unbound pool.
+ */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/cpumask.h>
+#include <linux/topology.h>
+#include <linux/nodemask.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/version.h>
+#include <linux/math64.h>
+#include <linux/time.h>
+
+#include "pisces_scrub.h"
+#include "pgtables.h"
+
+
+int scrub_on_add = 0;
+module_param(scrub_on_add, int, 0644);
+MODULE_PARM_DESC(scrub_on_add, "Zero memory before it is added to a running enclave");
+
+int scrub_on_free = 1;
+module_param(scrub_on_free, int, 0644);
+MODULE_PARM_DESC(scrub_on_free, "Zero enclave memory when the enclave is freed");
+
+
+#define SCRUB_CHUNK_SIZE (64 * 1024 * 1024)
+
+extern struct proc_dir_entry * pisces_proc_dir;
+
+struct scrub_work {
+    struct work_struct    work;
+    struct pisces_scrub * scrub;
+    u64                   base_addr;
+    u64                   size;
+    int                   node;
+};
+
+struct scrub_node_stats {
+    atomic64_t bytes;
+    atomic64_t chunks;
+    atomic64_t busy_ns;
+};
+
+static struct workqueue_struct * scrub_wq = NULL;
+static struct scrub_node_stats   scrub_stats[MAX_NUMNODES];
+
+
+
+static void
+nt_memzero(void * addr,
+	   u64    size)
+{
+    u64 * ptr = addr;
+    u64   cnt = size / 64;
+
+    while (cnt--) {
+	asm volatile ("movnti %1,  0(%0)\n\t"
+		      "movnti %1,  8(%0)\n\t"
+		      "movnti %1, 16(%0)\n\t"
+		      "movnti %1, 24(%0)\n\t"
+		      "movnti %1, 32(%0)\n\t"
+		      "movnti %1, 40(%0)\n\t"
+		      "movnti %1, 48(%0)\n\t"
+		      "movnti %1, 56(%0)\n\t"
+		      :
+		      : "r"(ptr), "r"(0ULL)
+		      : "memory");
+	ptr += 8;
+    }
+
+    memset(ptr, 0, size % 64);
+
+    /* Non-temporal stores are weakly ordered */
+    asm volatile ("sfence" ::: "memory");
+}
+
+
+static void
+scrub_chunk(struct work_struct * work)
+{
+    struct scrub_work   * chunk = container_of(work, struct scrub_work, work);
+    struct pisces_scrub * scrub = chunk->scrub;
+    ktime_t start = ktime_get();
+    u64     done  = 0;
+
+    while (done < chunk->size) {
+	u64 len = min_t(u64, PAGE_SIZE_2MB, chunk->size - done);
+
+	nt_memzero(__va(chunk->base_addr + done), len);
+	done += len;
+
+	cond_resched();
+    }
+
+    atomic64_add(chunk->size, &(scrub_stats[chunk->node].bytes));
+    atomic64_inc(&(scrub_stats[chunk->node].chunks));
+    atomic64_add(ktime_to_ns(ktime_sub(ktime_get(), start)), &(scrub_stats[chunk->node].busy_ns));
+
+    if (atomic_dec_and_test(&(scrub->pending))) {
+	complete(&(scrub->done));
+    }
+}
+
+
+/* Round robin over the online CPUs of a node, -1 if it has none */
+static int
+scrub_pick_cpu(int node,
+	       u32 idx)
+{
+    const struct cpumask * node_mask = cpumask_of_node(node);
+    int num_cpus = 0;
+    int cpu      = 0;
+
+    for_each_cpu_and(cpu, node_mask, cpu_online_mask) {
+	num_cpus++;
+    }
+
+    if (num_cpus == 0) {
+	return -1;
+    }
+
+    idx %= num_cpus;
+
+    for_each_cpu_and(cpu, node_mask, cpu_online_mask) {
+	if (idx-- == 0) {
+	    return cpu;
+	}
+    }
+
+    return -1;
+}
+
+
+int
+pisces_scrub_start(struct pisces_scrub * scrub,
+		   u64                   base_addr,
+		   u64                   size)
+{
+    u32 i = 0;
+
+    memset(scrub, 0, sizeof(struct pisces_scrub));
+
+    scrub->base_addr  = base_addr;
+    scrub->size       = size;
+    scrub->num_chunks = DIV_ROUND_UP(size, SCRUB_CHUNK_SIZE);
+    scrub->start_time = ktime_get();
+
+    init_completion(&(scrub->done));
+
+    if (scrub->num_chunks == 0) {
+	complete(&(scrub->done));
+	return 0;
+    }
+
+    scrub->chunks = kcalloc(scrub->num_chunks, sizeof(struct scrub_work), GFP_KERNEL);
+
+    if (!scrub->chunks) {
+	printk(KERN_ERR "Could not allocate scrub state for %llu bytes at %p\n",
+	       size, (void *)base_addr);
+	return -1;
+    }
+
+    atomic_set(&(scrub->pending), scrub->num_chunks);
+
+    for (i = 0; i < scrub->num_chunks; i++) {
+	struct scrub_work * chunk = &(scrub->chunks[i]);
+	int cpu = 0;
+
+	INIT_WORK(&(chunk->work), scrub_chunk);
+
+	chunk->scrub     = scrub;
+	chunk->base_addr = base_addr + ((u64)i * SCRUB_CHUNK_SIZE);
+	chunk->size      = min_t(u64, SCRUB_CHUNK_SIZE, size - ((u64)i * SCRUB_CHUNK_SIZE));
+	chunk->node      = pfn_to_nid(chunk->base_addr >> PAGE_SHIFT);
+
+	cpu = scrub_pick_cpu(chunk->node, i);
+
+	if (cpu == -1) {
+	    queue_work(system_unbound_wq, &(chunk->work));
+	} else {
+	    queue_work_on(cpu, scrub_wq, &(chunk->work));
+	}
+    }
+
+    return 0;
+}
+
+
+void
+pisces_scrub_wait(struct pisces_scrub * scrub)
+{
+    u64 usecs = 0;
+
+    wait_for_completion(&(scrub->done));
+
+    usecs = ktime_to_us(ktime_sub(ktime_get(), scrub->start_time));
+
+    printk(KERN_DEBUG "Scrubbed %llu MB at %p in %llu usecs\n",
+	   scrub->size / (1024 * 1024), (void *)scrub->base_addr, usecs);
+
+    kfree(scrub->chunks);
+    scrub->chunks = NULL;
+}
+
+
+int
+pisces_scrub_range(u64 base_addr,
+		   u64 size)
+{
+    struct pisces_scrub scrub;
+
+    if (pisces_scrub_start(&scrub, base_addr, size) != 0) {
+	return -1;
+    }
+
+    pisces_scrub_wait(&scrub);
+
+    return 0;
+}
+
+
+int
+pisces_scrub_check_offline(u64 base_addr,
+			   u64 size)
+{
+#if defined(CONFIG_SPARSEMEM) && (LINUX_VERSION_CODE >= KERNEL_VERSION(4,13,0))
+    unsigned long pfn     = base_addr >> PAGE_SHIFT;
+    unsigned long end_pfn = (base_addr + size) >> PAGE_SHIFT;
+
+    if ((base_addr & ~PAGE_MASK) || (size & ~PAGE_MASK)) {
+	return -1;
+    }
+
+    /* Memory is offlined a whole section at a time. PageReserved is no test, 
+     *   kernel text and firmware reservations are reserved too 
+     */
+    for (; pfn < end_pfn; pfn = ALIGN(pfn + 1, PAGES_PER_SECTION)) {
+	if ((!pfn_valid(pfn)) ||
+	    (online_section_nr(pfn_to_section_nr(pfn)))) {
+	    return -1;
+	}
+    }
+
+    return 0;
+#else
+    /* No per section online state to tell offlined memory from reserved memory */
+    printk(KERN_ERR "This kernel cannot report offline memory sections\n");
+    return -1;
+#endif
+}
+
+
+
+static int
+scrub_proc_show(struct seq_file * s,
+		void            * v)
+{
+    int node = 0;
+
+    seq_printf(s, "%-6s %16s %10s %16s %10s\n", "node", "bytes", "chunks", "busy_ns", "MB/s");
+
+    for_each_online_node(node) {
+	u64 bytes   = atomic64_read(&(scrub_stats[node].bytes));
+	u64 busy_ns = atomic64_read(&(scrub_stats[node].busy_ns));
+	u64 mbps    = 0;
+
+	/* In KB so the multiply can't overflow for any realistic total */
+	if (busy_ns) {
+	    mbps = div64_u64((bytes / 1024) * NSEC_PER_SEC, busy_ns) / 1024;
+	}
+
+	/* Per worker bandwidth, aggregate bandwidth scales with the node's CPU count */
+	seq_printf(s, "%-6d %16llu %10llu %16llu %10llu\n",
+		   node,
+		   bytes,
+		   (u64)atomic64_read(&(scrub_stats[node].chunks)),
+		   busy_ns,
+		   mbps);
+    }
+
+    return 0;
+}
+
+static int
+scrub_proc_open(struct inode * inode,
+		struct file  * filp)
+{
+    return single_open(filp, scrub_proc_show, NULL);
+}
+
+static struct file_operations scrub_proc_ops = {
+    .owner     = THIS_MODULE,
+    .open      = scrub_proc_open,
+    .read      = seq_read,
+    .llseek    = seq_lseek,
+    .release   = single_release,
+};
+
+
+
+int
+pisces_scrub_init(void)
+{
+    struct proc_dir_entry * scrub_entry = NULL;
+    int i = 0;
+
+    for (i = 0; i < MAX_NUMNODES; i++) {
+	atomic64_set(&(scrub_stats[i].bytes),   0);
+	atomic64_set(&(scrub_stats[i].chunks),  0);
+	atomic64_set(&(scrub_stats[i].busy_ns), 0);
+    }
+
+    scrub_wq = alloc_workqueue("pisces_scrub", 0, 0);
+
+    if (!scrub_wq) {
+	printk(KERN_ERR "Could not create scrub workqueue\n");
+	return -1;
+    }
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
+    scrub_entry = create_proc_entry("scrub", 0444, pisces_proc_dir);
+
+    if (scrub_entry) {
+	scrub_entry->proc_fops = &scrub_proc_ops;
+    }
+#else
+    scrub_entry = proc_create_data("scrub", 0444, pisces_proc_dir, &scrub_proc_ops, NULL);
+#endif
+
+    if (!scrub_entry) {
+	printk(KERN_ERR "Error creating scrub proc file\n");
+    }
+
+    return 0;
+}
+
+
+void
+pisces_scrub_deinit(void)
+{
+    remove_proc_entry("scrub", pisces_proc_dir);
+
+    destroy_workqueue(scrub_wq);
+}
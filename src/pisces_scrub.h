@@ -0,0 +1,55 @@
+/* Pisces physical memory scrubbing
+ *  Zeroes offlined physical memory ranges in parallel, using worker threads
+ *  on the CPUs local to the memory's NUMA node.
+ */
+
+#ifndef __PISCES_SCRUB_H__
+#define __PISCES_SCRUB_H__
+
+#include <linux/types.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/ktime.h>
+
+struct scrub_work;
+
+/* State for one in-flight scrub request */
+struct pisces_scrub {
+    u64                 base_addr;
+    u64                 size;
+
+    struct scrub_work * chunks;
+    u32                 num_chunks;
+    atomic_t            pending;
+    struct completion   done;
+    ktime_t             start_time;
+};
+
+
+/* Set by module parameters */
+extern int scrub_on_add;
+extern int scrub_on_free;
+
+
+/* Asynchronous interface, every successful start must be followed by a wait */
+int pisces_scrub_start(struct pisces_scrub * scrub,
+		       u64                   base_addr,
+		       u64                   size);
+
+void pisces_scrub_wait(struct pisces_scrub * scrub);
+
+
+/* Synchronous scrub of a physical range */
+int pisces_scrub_range(u64 base_addr,
+		       u64 size);
+
+
+/* Returns 0 if every memory section the range touches is offlined from Linux */
+int pisces_scrub_check_offline(u64 base_addr,
+			       u64 size);
+
+
+int  pisces_scrub_init(void);
+void pisces_scrub_deinit(void);
+
+#endif
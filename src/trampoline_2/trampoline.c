@@ -113,7 +113,7 @@ setup_enclave_trampoline(struct pisces_enclave * enclave)
 
     memset(trampoline_level4_pgt, 0, PAGE_SIZE);                             /* Clear old PT Entries */
 
-    memcpy(trampoline_level4_pgt, __va(trampoline_state.pml_pa), PAGE_SIZE); /* Overwrite 1st PML Entry (512GB) with our own PDP */
+    memcpy(trampoline_level4_pgt, __va(enclave->boot_pgts->pml_pa), PAGE_SIZE); /* Overwrite 1st PML Entry (512GB) with our own PDP */
     
     memcpy(__va(__x86_trampoline_base), trampoline_data, TRAMPOLINE_SIZE);
 
@@ -131,7 +131,7 @@ setup_enclave_trampoline(struct pisces_enclave * enclave)
     memcpy(cached_pgd_ptr, trampoline_pgd_ptr, PAGE_SIZE);       /* Save current trampoline PGD contents */
 
   
-    memcpy(trampoline_pgd_ptr, __va(trampoline_state.pml_pa), PAGE_SIZE);       /* Copy in our own PGD */
+    memcpy(trampoline_pgd_ptr, __va(enclave->boot_pgts->pml_pa), PAGE_SIZE);       /* Copy in our own PGD */
 
 
     cached_trampoline_target = *trampoline_target;
@@ -14,6 +14,10 @@
 #include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/mm.h>
+#include <linux/eventfd.h>
+#include <linux/version.h>
 
 #include "util-queue.h"
 #include "pisces_irq.h"
@@ -78,6 +82,9 @@ struct cons_ring_buf {
     struct cons_msg msgs[0];
 } __attribute__((packed));
 
+/* Most messages dequeued by one read() */
+#define CONS_READ_BATCH 256
+
 struct palacios_console {
     struct pisces_enclave * enclave;
     u32 vm_id;
@@ -88,6 +95,18 @@ struct palacios_console {
 
     struct cons_ring_buf * ring_buf;
 
+    /* Messages are staged here so copy_to_user happens outside the ring lock */
+    struct mutex      read_lock;
+    struct cons_msg * read_batch;
+
+    /* Set if the enclave does not understand PISCES_CMD_VM_CONS_KEYCODES */
+    int single_keycodes;
+
+    /* Signalled along with intr_queue, protected by irq_lock */
+    struct eventfd_ctx * kick_eventfd;
+
+    /* Live mmap()s of the ring, consumed through the eventfd instead of poll */
+    atomic_t mmap_count;
 };
 
 
@@ -101,43 +120,108 @@ cons_kick(int    irq,
 
     if (entries > 0) {
 	wake_up_interruptible(&(cons->intr_queue));
+
+	spin_lock(&(cons->irq_lock));
+	{
+	    if (cons->kick_eventfd) {
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6,8,0)
+		eventfd_signal(cons->kick_eventfd, 1);
+#else
+		eventfd_signal(cons->kick_eventfd);
+#endif
+	    }
+	}
+	spin_unlock(&(cons->irq_lock));
     }
 
     return IRQ_HANDLED;
 }
 
 
+/* The ring's pages, and where the ring starts in them */
+static void
+cons_ring_span(struct palacios_console * cons, 
+	       unsigned long           * base_pa, 
+	       unsigned long           * size,
+	       unsigned long           * offset)
+{
+    unsigned long ring_pa  = __pa(cons->ring_buf);
+    unsigned long ring_len = sizeof(struct cons_ring_buf) + 
+	(cons->ring_buf->total_entries * sizeof(struct cons_msg));
+
+    *base_pa = ring_pa & PAGE_MASK;
+    *offset  = ring_pa - *base_pa;
+    *size    = PAGE_ALIGN(*offset + ring_len);
+}
+
+
+/* Hands cnt consumed messages back to the producer, called with the ring lock held */
+static void
+cons_release_entries(struct cons_ring_buf * ringbuf, 
+		     u16                    cnt)
+{
+    __asm__ __volatile__ ("lock subw %1, %0;"
+			  : "+m"(ringbuf->cur_entries)
+			  : "r"(cnt)
+			  : "memory");
+
+    ringbuf->read_idx += cnt;
+    ringbuf->read_idx %= ringbuf->total_entries;
+}
+
+
+/* Dequeues up to max_msgs messages in one lock hold, returns the number dequeued */
 static int 
 cons_dequeue(struct cons_ring_buf * ringbuf, 
-	     struct cons_msg      * msg) 
+	     struct cons_msg      * msgs,
+	     u16                    max_msgs) 
 {
-    int ret = -1;
+    u16 cnt = 0;
 
     pisces_spin_lock(&(ringbuf->lock));
     {
-	if (ringbuf->cur_entries > 0) {	    
-	    memcpy(msg, &(ringbuf->msgs[ringbuf->read_idx]), sizeof(struct cons_msg));
-	    
-	    __asm__ __volatile__ ("lock decw %1;"
-				  : "+m"(ringbuf->cur_entries)
-				  :
-				  : "memory");
+	cnt = min_t(u16, ringbuf->cur_entries, max_msgs);
+
+	if (cnt > 0) {
+	    u16 first = min_t(u16, cnt, ringbuf->total_entries - ringbuf->read_idx);
+
+	    memcpy(msgs,         &(ringbuf->msgs[ringbuf->read_idx]), first         * sizeof(struct cons_msg));
+	    memcpy(msgs + first, &(ringbuf->msgs[0]),                 (cnt - first) * sizeof(struct cons_msg));
 	    
-	    ringbuf->read_idx += 1;
-	    ringbuf->read_idx %= ringbuf->total_entries;
+	    cons_release_entries(ringbuf, cnt);
+	}
+    }
+    pisces_spin_unlock(&(ringbuf->lock));
+    
+    return cnt;
+}
+
 
-	    ret = 0;
+/* Drops up to max_msgs messages an mmap() consumer has handled in place, returns the number dropped */
+static int 
+cons_consume(struct cons_ring_buf * ringbuf, 
+	     u16                    max_msgs) 
+{
+    u16 cnt = 0;
+
+    pisces_spin_lock(&(ringbuf->lock));
+    {
+	cnt = min_t(u16, ringbuf->cur_entries, max_msgs);
+
+	if (cnt > 0) {
+	    cons_release_entries(ringbuf, cnt);
 	}
     }
     pisces_spin_unlock(&(ringbuf->lock));
     
-    return ret;
+    return cnt;
 }
 
 
 
 
 
+/* Returns as many whole messages as fit in the buffer */
 static ssize_t 
 console_read(struct file * filp, 
 	     char __user * buf, 
@@ -145,65 +229,133 @@ console_read(struct file * filp,
 	     loff_t      * offset) 
 {
     struct palacios_console * cons = filp->private_data;
-    struct cons_msg msg;
-    int ret = 0;
-
-    memset(&msg, 0, sizeof(struct cons_msg));
+    u16 max_msgs = min_t(size_t, size / sizeof(struct cons_msg), CONS_READ_BATCH);
+    int cnt      = 0;
 
-    if (size != sizeof(struct cons_msg)) {
+    if (max_msgs == 0) {
 	printk(KERN_ERR "Invalid Read operation size: %lu\n", size);
 	return -EFAULT;
     }
 
-    wait_event_interruptible(cons->intr_queue, (cons->ring_buf->cur_entries >= 1));
+    while (cnt == 0) {
+	if ((cons->ring_buf->cur_entries == 0) && (filp->f_flags & O_NONBLOCK)) {
+	    return -EAGAIN;
+	}
 
-    
-    ret = cons_dequeue(cons->ring_buf, &msg);
-    
-    
-    if (ret == -1) {
-	printk(KERN_ERR "ERROR: Null console message\n");
-	return -EFAULT;
+	if (wait_event_interruptible(cons->intr_queue, (cons->ring_buf->cur_entries >= 1)) != 0) {
+	    return -ERESTARTSYS;
+	}
+
+	mutex_lock(&(cons->read_lock));
+	{
+	    cnt = cons_dequeue(cons->ring_buf, cons->read_batch, max_msgs);
+
+	    if ((cnt > 0) && 
+		(copy_to_user(buf, cons->read_batch, cnt * sizeof(struct cons_msg)))) {
+		printk(KERN_ERR "Read Fault\n");
+		cnt = -EFAULT;
+	    }
+	}
+	mutex_unlock(&(cons->read_lock));
     }
-    
-    if (copy_to_user(buf, &msg, size)) {
-	printk(KERN_ERR "Read Fault\n");
-	return -EFAULT;
+
+    if (cnt < 0) {
+	return cnt;
     }
- 
 
-    return size;
+    return cnt * sizeof(struct cons_msg);
 }
 
 
-static ssize_t 
-console_write(struct file       * filp,
-	      const char __user * buf, 
-	      size_t              size, 
-	      loff_t            * offset) 
+/* Fallback for enclaves without PISCES_CMD_VM_CONS_KEYCODES, one message per scan code */
+static void
+send_keycodes_single(struct palacios_console * cons, 
+		     u8                      * scan_codes, 
+		     u32                       num_codes)
 {
-    struct palacios_console    * cons      = filp->private_data;
     struct pisces_xbuf_desc    * xbuf_desc = cons->enclave->ctrl.xbuf_desc;
     struct cmd_vm_cons_keycode   cmd;
     int i = 0;
 
     memset(&cmd, 0, sizeof(struct cmd_vm_cons_keycode));
 
-
     cmd.hdr.cmd      = PISCES_CMD_VM_CONS_KEYCODE;
     cmd.hdr.data_len = (sizeof(struct cmd_vm_cons_keycode) - sizeof(struct pisces_cmd));
     cmd.vm_id        = cons->vm_id;
   
-    for (i = 0; i < size; i++) {
-	if (copy_from_user(&(cmd.scan_code), buf + i, 1)) {
+    for (i = 0; i < num_codes; i++) {
+	cmd.scan_code = scan_codes[i];
+
+	//printk("Sending Scan_Code %x\n", cmd.scan_code);
+
+	pisces_xbuf_send(xbuf_desc, (u8 *)&cmd, sizeof(struct cmd_vm_cons_keycode));
+    }
+}
+
+
+static ssize_t 
+console_write(struct file       * filp,
+	      const char __user * buf, 
+	      size_t              size, 
+	      loff_t            * offset) 
+{
+    struct palacios_console     * cons      = filp->private_data;
+    struct pisces_xbuf_desc     * xbuf_desc = cons->enclave->ctrl.xbuf_desc;
+    struct cmd_vm_cons_keycodes * cmd       = NULL;
+    size_t sent = 0;
+
+    cmd = kmalloc(sizeof(struct cmd_vm_cons_keycodes) + PISCES_MAX_VM_CONS_KEYCODES, GFP_KERNEL);
+
+    if (!cmd) {
+	return -ENOMEM;
+    }
+
+    while (sent < size) {
+	struct pisces_resp * resp     = NULL;
+	u32                  resp_len = 0;
+	u32                  cnt      = min_t(size_t, size - sent, PISCES_MAX_VM_CONS_KEYCODES);
+	int                  ret      = 0;
+
+	memset(cmd, 0, sizeof(struct cmd_vm_cons_keycodes));
+
+	if (copy_from_user(cmd->scan_codes, buf + sent, cnt)) {
 	    printk(KERN_ERR "Console Write fault\n");
+	    kfree(cmd);
 	    return -EFAULT;
 	}
-	
-	 //printk("Sending Scan_Code %x\n", cmd.scan_code);
 
-	 pisces_xbuf_send(xbuf_desc, (u8 *)&cmd, sizeof(struct cmd_vm_cons_keycode));
+	if (cons->single_keycodes) {
+	    send_keycodes_single(cons, cmd->scan_codes, cnt);
+	    sent += cnt;
+	    continue;
+	}
+
+	cmd->hdr.cmd      = PISCES_CMD_VM_CONS_KEYCODES;
+	cmd->hdr.data_len = (sizeof(struct cmd_vm_cons_keycodes) - sizeof(struct pisces_cmd)) + cnt;
+	cmd->vm_id        = cons->vm_id;
+	cmd->num_codes    = cnt;
+
+	ret = pisces_xbuf_sync_send(xbuf_desc, (u8 *)cmd, sizeof(struct cmd_vm_cons_keycodes) + cnt, 
+				    (u8 **)&resp, &resp_len);
+
+	if ((ret != 0) || 
+	    (resp == NULL) || (resp_len < sizeof(struct pisces_resp)) || 
+	    (resp->status != 0)) {
+	    printk(KERN_WARNING "Enclave %d did not accept batched keycodes, sending them one at a time\n", 
+		   cons->enclave->id);
+
+	    cons->single_keycodes = 1;
+	    send_keycodes_single(cons, cmd->scan_codes, cnt);
+	}
+
+	if (ret == 0) {
+	    kfree(resp);
+	}
+
+	sent += cnt;
     }
+
+    kfree(cmd);
     
     return size;
 }
@@ -219,6 +371,11 @@ console_poll(struct file              * filp,
     //    printk(KERN_DEBUG "Console=%p (guest=%s)\n", cons, cons->guest->name);
 
 
+    if (atomic_read(&(cons->mmap_count)) > 0) {
+	/* Only report that the enclave wants the mapping gone */
+	return pisces_cons_poll_hup(cons->enclave, filp, poll_tb);
+    }
+
     poll_wait(filp, &(cons->intr_queue), poll_tb);
 
     pisces_spin_lock(&(cons->ring_buf->lock));
@@ -236,6 +393,168 @@ console_poll(struct file              * filp,
 }
 
 
+static long
+console_ioctl(struct file  * filp,
+	      unsigned int   ioctl,
+	      unsigned long  arg)
+{
+    struct palacios_console * cons = filp->private_data;
+    void __user             * argp = (void __user *)arg;
+
+    switch (ioctl) {
+	case PISCES_VM_CONS_RING_INFO: {
+	    struct vm_cons_ring_info info;
+	    unsigned long base_pa = 0;
+	    unsigned long size    = 0;
+	    unsigned long offset  = 0;
+
+	    cons_ring_span(cons, &base_pa, &size, &offset);
+
+	    memset(&info, 0, sizeof(struct vm_cons_ring_info));
+
+	    info.mmap_size          = size;
+	    info.ring_offset        = offset;
+	    info.read_idx_offset    = offsetof(struct cons_ring_buf, read_idx);
+	    info.write_idx_offset   = offsetof(struct cons_ring_buf, write_idx);
+	    info.cur_entries_offset = offsetof(struct cons_ring_buf, cur_entries);
+	    info.msgs_offset        = offsetof(struct cons_ring_buf, msgs);
+	    info.total_entries      = cons->ring_buf->total_entries;
+	    info.msg_size           = sizeof(struct cons_msg);
+
+	    if (copy_to_user(argp, &info, sizeof(struct vm_cons_ring_info))) {
+		return -EFAULT;
+	    }
+
+	    return 0;
+	}
+	case PISCES_VM_CONS_SET_EVENTFD: {
+	    struct eventfd_ctx * new_ctx = NULL;
+	    struct eventfd_ctx * old_ctx = NULL;
+	    int                  efd     = (int)arg;
+	    unsigned long        flags   = 0;
+
+	    /* A negative fd just removes the current eventfd */
+	    if (efd >= 0) {
+		new_ctx = eventfd_ctx_fdget(efd);
+
+		if (IS_ERR(new_ctx)) {
+		    return PTR_ERR(new_ctx);
+		}
+	    }
+
+	    spin_lock_irqsave(&(cons->irq_lock), flags);
+	    {
+		old_ctx            = cons->kick_eventfd;
+		cons->kick_eventfd = new_ctx;
+	    }
+	    spin_unlock_irqrestore(&(cons->irq_lock), flags);
+
+	    if (old_ctx) {
+		eventfd_ctx_put(old_ctx);
+	    }
+
+	    return 0;
+	}
+	case PISCES_VM_CONS_CONSUME: {
+	    int cnt = 0;
+
+	    if (arg > 0xffff) {
+		return -EINVAL;
+	    }
+
+	    mutex_lock(&(cons->read_lock));
+	    {
+		cnt = cons_consume(cons->ring_buf, (u16)arg);
+	    }
+	    mutex_unlock(&(cons->read_lock));
+
+	    return cnt;
+	}
+	default:
+	    printk(KERN_ERR "Invalid VM console IOCTL (%u)\n", ioctl);
+	    return -EINVAL;
+    }
+}
+
+
+/* The ring lives in enclave memory, each mapping pins the enclave. 
+ *   The mapping's file keeps the console itself around.
+ */
+static void
+console_vm_open(struct vm_area_struct * vma)
+{
+    struct palacios_console * cons = vma->vm_private_data;
+
+    atomic_inc(&(cons->mmap_count));
+    pisces_cons_mmap_get(cons->enclave);
+}
+
+static void
+console_vm_close(struct vm_area_struct * vma)
+{
+    struct palacios_console * cons = vma->vm_private_data;
+
+    atomic_dec(&(cons->mmap_count));
+    pisces_cons_mmap_put(cons->enclave);
+}
+
+static struct vm_operations_struct cons_vm_ops = {
+    .open  = console_vm_open,
+    .close = console_vm_close,
+};
+
+
+/* Maps the pages holding the ring read-only, see struct vm_cons_ring_info
+ *   The ring must start on a page so nothing in front of it is exposed
+ */
+static int
+console_mmap(struct file           * filp, 
+	     struct vm_area_struct * vma)
+{
+    struct palacios_console * cons = filp->private_data;
+    unsigned long base_pa = 0;
+    unsigned long size    = 0;
+    unsigned long offset  = 0;
+
+    cons_ring_span(cons, &base_pa, &size, &offset);
+
+    if ((offset != 0) ||
+	(vma->vm_pgoff != 0) || 
+	(vma->vm_end - vma->vm_start != size) ||
+	(!(vma->vm_flags & VM_SHARED))) {
+	return -EINVAL;
+    }
+
+    /* The ring lock, write_idx and the kick fields are the enclave's */
+    if (vma->vm_flags & VM_WRITE) {
+	return -EPERM;
+    }
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6,3,0)
+    vma->vm_flags &= ~VM_MAYWRITE;
+#else
+    vm_flags_clear(vma, VM_MAYWRITE);
+#endif
+
+    if (pisces_cons_mmap_pin(cons->enclave) != 0) {
+	return -ENODEV;
+    }
+
+    if (remap_pfn_range(vma, vma->vm_start, base_pa >> PAGE_SHIFT, 
+			size, vma->vm_page_prot) != 0) {
+	pisces_cons_mmap_put(cons->enclave);
+	return -EAGAIN;
+    }
+
+    vma->vm_ops          = &cons_vm_ops;
+    vma->vm_private_data = cons;
+
+    atomic_inc(&(cons->mmap_count));
+
+    return 0;
+}
+
+
 static int 
 console_release(struct inode * i, 
 		struct file  * filp) 
@@ -260,12 +579,17 @@ console_release(struct inode * i,
     pisces_release_irq(cons->irq, cons);
 //    pisces_remove_ipi_callback(cons_kick, cons);
 
+    if (cons->kick_eventfd) {
+	eventfd_ctx_put(cons->kick_eventfd);
+    }
+
     if (ret != 0) {
 	printk(KERN_ERR "Error sending disconnect message to VM %d on enclave (%d)\n", 
 	       cons->vm_id, enclave->id);
     }
 
 
+    kfree(cons->read_batch);
     kfree(cons);
     
 
@@ -277,6 +601,9 @@ static struct file_operations cons_fops = {
     .read     = console_read,
     .write    = console_write,
     .poll     = console_poll,
+    .mmap     = console_mmap,
+    .unlocked_ioctl = console_ioctl,
+    .compat_ioctl   = console_ioctl,
     .release  = console_release,
 };
 
@@ -299,14 +626,26 @@ v3_console_connect(struct pisces_enclave * enclave,
 	return -1;
     }
 
+    cons->read_batch = kmalloc(CONS_READ_BATCH * sizeof(struct cons_msg), GFP_KERNEL);
+
+    if (!cons->read_batch) {
+	printk(KERN_ERR "Error allocating pisces VM console read buffer\n");
+	kfree(cons);
+	return -1;
+    }
+
     cons->enclave                = enclave;
     cons->vm_id                  = vm_id;
+    cons->single_keycodes        = 0;
+    cons->kick_eventfd           = NULL;
+    atomic_set(&(cons->mmap_count), 0);
     cons->ring_buf               = __va(cons_buf_pa);
     cons->ring_buf->kick_apic    = apic->cpu_present_to_apicid(0);
 
     cons->irq = pisces_request_irq(cons_kick, cons);
     if (cons->irq < 0) {
 	printk(KERN_WARNING "Failed to allocate IRQ\n");
+	kfree(cons->read_batch);
 	kfree(cons);
 	return -1;
     }
@@ -314,12 +653,14 @@ v3_console_connect(struct pisces_enclave * enclave,
     cons->ring_buf->kick_ipi_vec = pisces_irq_to_vector(cons->irq);
     if (cons->ring_buf->kick_ipi_vec < 0) {
 	printk(KERN_WARNING "Failed to convert IRQ %d to IPI vector\n", cons->irq);
+	kfree(cons->read_batch);
 	kfree(cons);
 	return -1;
     }
 
     init_waitqueue_head(&(cons->intr_queue));
     spin_lock_init(&(cons->irq_lock));
+    mutex_init(&(cons->read_lock));
 
     __asm__ __volatile__ ("" ::: "memory");
 